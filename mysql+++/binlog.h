@@ -0,0 +1,455 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <random>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+#include <exception>
+
+#include "mysql+++.h"
+#include "cache.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		enum class table_change {
+			insert,
+			update,
+			remove,
+			statement,		// DDL or statement-based DML naming the table (TRUNCATE, ALTER...)
+			unknown			// events may have been missed, e.g. when the listener (re)starts or resumes reading
+		};
+
+
+		struct binlog_options {
+			unsigned int server_id = 0;							// replica id, unique among the replicas of the server; 0 for a random one
+			std::string file;									// binary log to start reading from, empty for the current end of the log
+			unsigned long long position = 4;
+			std::chrono::seconds heartbeat{ 1 };				// the server sends a heartbeat after this idle time, bounding the delay of `stop'
+			std::chrono::milliseconds reconnect_delay{ 1000 };
+			std::function<void(std::exception_ptr)> on_error;	// called on the listener thread for every error
+		};
+
+
+		namespace binlog_detail {
+			enum event_type {
+				query_log_event = 2,
+				rotate_event = 4,
+				xid_event = 16,
+				table_map_event = 19,
+				write_rows_event_v1 = 23,
+				update_rows_event_v1 = 24,
+				delete_rows_event_v1 = 25,
+				write_rows_event = 30,
+				update_rows_event = 31,
+				delete_rows_event = 32,
+				xa_prepare_log_event = 38,
+				partial_update_rows_event = 39
+			};
+
+			static const std::size_t header_length = 19;
+
+			// little-endian unsigned integer of `n' bytes
+			inline std::uint64_t read_uint(const unsigned char* p, unsigned int n) {
+				std::uint64_t v = 0;
+				for (unsigned int i = n; i > 0; i--)
+					v = (v << 8) | p[i - 1];
+				return v;
+			}
+
+			inline bool contains_word(const std::string& text, const std::string& word) {
+				auto lower = [](char c) { return (char)std::tolower((unsigned char)c); };
+				auto ident = [](char c) { return std::isalnum((unsigned char)c) || c == '_' || c == '$'; };
+
+				for (std::size_t i = 0; i + word.length() <= text.length(); i++) {
+					std::size_t k = 0;
+					while (k < word.length() && lower(text[i + k]) == lower(word[k])) k++;
+					if (k < word.length()) continue;
+
+					if ((i == 0 || !ident(text[i - 1])) && (i + k == text.length() || !ident(text[i + k]))) return true;
+				}
+				return false;
+			}
+		}
+
+
+		// replication client following the binary log of a server to learn, within milliseconds, which
+		// tables are written to; typically used to invalidate client-side caches (see `query_cache')
+		//
+		// row events are attributed to their table through the preceding table map event; the row images
+		// themselves are not decoded. The server needs binlog_format=ROW for DML to be seen per table, and
+		// the account the REPLICATION SLAVE (REPLICATION REPLICA) privilege. Requires a client library
+		// with mysql_binlog_open (MySQL 8.0 and later); otherwise `start' throws
+		//
+		// handlers run on the listener's thread, which resumes from the end of the last complete transaction
+		// after a disconnection, so the events of a transaction cut short are seen again
+		class binlog_listener {
+		public:
+			using handler = std::function<void(const std::string& db, const std::string& table, table_change change)>;
+
+			struct statistics {
+				unsigned long long events;
+				unsigned long long row_events;			// row events of watched tables
+				unsigned long long reconnects;
+				std::string file;						// end of the last complete transaction read
+				unsigned long long position;
+				bool failed;							// stopped on an error that reconnecting cannot fix
+			};
+
+		protected:
+			struct watch_entry {
+				std::string db;							// empty for any database
+				std::string table;
+				handler fn;
+			};
+
+			connect_options options;
+			binlog_options bopts;
+			std::vector<watch_entry> watches;
+			std::unordered_map<std::uint64_t, std::vector<std::size_t>> table_ids;		// table id of the binlog -> watches
+
+			mutable std::mutex position_mutex;
+			std::string file;						// where to resume: always at a transaction boundary, so that
+			unsigned long long position;			// the table map events of a transaction are read again
+			bool in_transaction = false;			// of the stream, between BEGIN and its commit
+
+			std::atomic<unsigned long long> num_events{ 0 };
+			std::atomic<unsigned long long> num_row_events{ 0 };
+			std::atomic<unsigned long long> num_reconnects{ 0 };
+
+			mutable std::mutex error_mutex;
+			std::exception_ptr error;				// last error of the listener thread
+			std::atomic<bool> failed{ false };
+
+			std::mutex stop_mutex;
+			std::condition_variable stop_cv;
+			std::atomic<bool> stopping{ false };
+			std::thread worker;
+
+
+			void notify_all(table_change change) {
+				for (auto& w : watches)
+					w.fn(w.db, w.table, change);
+			}
+
+			void set_position(const std::string* new_file, unsigned long long new_position) {
+				std::lock_guard<std::mutex> lg(position_mutex);
+				if (new_file != nullptr) file = *new_file;
+				position = new_position;
+			}
+
+			void on_event(const unsigned char* packet, std::size_t size) {
+				using namespace binlog_detail;
+
+				// OK marker, then the event
+				if (size < 1 + header_length || packet[0] != 0) return;
+				const unsigned char* ev = packet + 1;
+				std::size_t len = size - 1;
+
+				num_events++;
+				unsigned int type = ev[4];
+				unsigned long long log_pos = read_uint(ev + 13, 4);
+				const unsigned char* body = ev + header_length;
+				std::size_t body_len = len - header_length;
+
+				switch (type) {
+				case rotate_event:
+					// between transactions
+					if (body_len >= 8) {
+						std::string next_file((const char*)body + 8, body_len - 8);
+						set_position(&next_file, read_uint(body, 8));
+						table_ids.clear();
+					}
+					return;
+
+				case xid_event:
+				case xa_prepare_log_event:
+					in_transaction = false;
+					break;
+
+				case table_map_event: {
+					// table id (6), flags (2), then length-prefixed and NUL-terminated names
+					if (body_len < 10) break;
+					std::uint64_t id = read_uint(body, 6);
+					const unsigned char* p = body + 8;
+					const unsigned char* end = body + body_len;
+
+					std::size_t db_len = *p++;
+					if (p + db_len + 2 > end) break;
+					std::string db((const char*)p, db_len);
+					p += db_len + 1;
+
+					std::size_t table_len = *p++;
+					if (p + table_len > end) break;
+					std::string table((const char*)p, table_len);
+
+					std::vector<std::size_t> matches;
+					for (std::size_t i = 0; i < watches.size(); i++)
+						if ((watches[i].db.empty() || watches[i].db == db) && watches[i].table == table) matches.push_back(i);
+
+					if (matches.empty()) table_ids.erase(id);
+					else table_ids[id] = std::move(matches);
+					break;
+				}
+
+				case write_rows_event_v1:
+				case update_rows_event_v1:
+				case delete_rows_event_v1:
+				case write_rows_event:
+				case update_rows_event:
+				case delete_rows_event:
+				case partial_update_rows_event: {
+					if (body_len < 6) break;
+					auto itr = table_ids.find(read_uint(body, 6));
+					if (itr == table_ids.end()) break;
+
+					table_change change =
+						(type == write_rows_event || type == write_rows_event_v1) ? table_change::insert :
+						(type == delete_rows_event || type == delete_rows_event_v1) ? table_change::remove : table_change::update;
+
+					num_row_events++;
+					for (auto i : itr->second)
+						watches[i].fn(watches[i].db, watches[i].table, change);
+					break;
+				}
+
+				case query_log_event: {
+					// thread id (4), execution time (4), database length (1), error code (2), status length (2),
+					// status variables, database + NUL, statement
+					if (body_len < 13) break;
+					std::size_t db_len = body[8];
+					std::size_t status_len = (std::size_t)read_uint(body + 11, 2);
+					std::size_t offset = 13 + status_len + db_len + 1;
+					if (offset > body_len) break;
+
+					std::string db((const char*)body + 13 + status_len, db_len);
+					std::string sql((const char*)body + offset, body_len - offset);
+					if (sql == "BEGIN" || sql.compare(0, 8, "XA START") == 0) {
+						in_transaction = true;
+						return;
+					}
+					if (sql == "COMMIT" || sql == "ROLLBACK") {
+						in_transaction = false;
+						break;
+					}
+
+					// the statement may name a table with or without its database, so match names only
+					for (auto& w : watches)
+						if (binlog_detail::contains_word(sql, w.table) && (w.db.empty() || w.db == db || binlog_detail::contains_word(sql, w.db)))
+							w.fn(w.db, w.table, table_change::statement);
+					break;
+				}
+				}
+
+				// the resume position moves at transaction boundaries only (artificial events have log_pos 0)
+				if (log_pos != 0 && !in_transaction) set_position(nullptr, log_pos);
+			}
+
+			// read the binary log until `stop' or an error
+			void stream() {
+#ifdef MYSQL_RPL_SKIP_HEARTBEAT
+				connect_options co = options;
+				if (co.read_timeout == 0) co.read_timeout = (unsigned int)(3 * bopts.heartbeat.count() + 5);
+
+				connection con;
+				if (!con.open(co)) throw mysql_exception(con.error_code(), std::string("Failed to connect: ") + con.error_message());
+
+				// events without checksums, and heartbeats while idle so that `stop' is noticed
+				unsigned long long heartbeat_ns = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(bopts.heartbeat).count();
+				con.exec("set @master_binlog_checksum = 'NONE', @source_binlog_checksum = 'NONE'");
+				con.exec("set @master_heartbeat_period = %llu, @source_heartbeat_period = %llu", heartbeat_ns, heartbeat_ns);
+
+				std::string start_file;
+				unsigned long long start_position;
+				{
+					std::lock_guard<std::mutex> lg(position_mutex);
+					start_file = file;
+					start_position = position;
+				}
+
+				if (start_file.empty()) {
+					// start at the current end of the log; whatever happened before is unknown
+					result res;
+					try {
+						res = con.query("show binary log status");
+						res.count();
+					}
+					catch (mysql_exception&) {
+						res = con.query("show master status");		// before MySQL 8.2
+					}
+					if (!res.fetch(start_file, start_position)) throw std::runtime_error("Binary logging is disabled");
+
+					set_position(&start_file, start_position);
+				}
+
+				MYSQL* my = con.get_raw_connection();
+				MYSQL_RPL rpl{};
+				rpl.file_name_length = start_file.length();
+				rpl.file_name = start_file.c_str();
+				rpl.start_position = start_position;
+				rpl.server_id = bopts.server_id;
+				rpl.flags = 0;
+
+				if (mysql_binlog_open(my, &rpl) != 0) throw mysql_exception(my);
+
+				// changes made while the listener was not reading may not all be replayed (a log was purged...)
+				in_transaction = false;
+				notify_all(table_change::unknown);
+
+				while (!stopping) {
+					if (mysql_binlog_fetch(my, &rpl) != 0) {
+						// 1236: the position cannot be read anymore (purged log...), restart at the end
+						if (mysql_errno(my) == 1236) {
+							std::string none;
+							set_position(&none, 4);
+						}
+						throw mysql_exception(my);
+					}
+					if (rpl.size == 0) break;
+
+					on_event(rpl.buffer, rpl.size);
+				}
+
+				mysql_binlog_close(my, &rpl);
+#else
+				throw std::runtime_error("The MySQL client library does not support reading binary logs");
+#endif
+			}
+
+			// errors that reconnecting does not fix: wrong credentials, missing REPLICATION SLAVE privilege
+			static bool is_permanent(unsigned int err) {
+				return err == ER_ACCESS_DENIED_ERROR || err == ER_DBACCESS_DENIED_ERROR || err == ER_SPECIFIC_ACCESS_DENIED_ERROR;
+			}
+
+			void run() {
+				thread_init_guard tg;
+
+				while (!stopping) {
+					bool permanent = false;
+					try {
+						stream();
+					}
+					catch (...) {
+						std::exception_ptr e = std::current_exception();
+						try {
+							throw;
+						}
+						catch (mysql_exception& exp) {
+							permanent = is_permanent(exp.error_number());
+						}
+						catch (...) {}
+
+						{
+							std::lock_guard<std::mutex> lg(error_mutex);
+							error = e;
+						}
+						if (bopts.on_error) {
+							try {
+								bopts.on_error(e);
+							}
+							catch (...) {}
+						}
+					}
+
+					if (permanent) {
+						failed = true;
+						break;
+					}
+					if (stopping) break;
+					num_reconnects++;
+
+					std::unique_lock<std::mutex> lk(stop_mutex);
+					stop_cv.wait_for(lk, bopts.reconnect_delay, [this] { return stopping.load(); });
+				}
+			}
+
+		public:
+			binlog_listener(const binlog_listener&) = delete;
+			void operator =(const binlog_listener&) = delete;
+
+			binlog_listener(const connect_options& _options, const binlog_options& _bopts = binlog_options())
+				: options(_options), bopts(_bopts), file(_bopts.file), position(_bopts.position)
+			{
+				if (bopts.server_id == 0) {
+					std::random_device rd;
+					bopts.server_id = (1u << 30) + rd() % (1u << 30);
+				}
+			}
+
+			virtual ~binlog_listener() {
+				stop();
+			}
+
+			// call `fn' on every change to `db'.`table' (any database if `db' is empty); before `start' only
+			binlog_listener& watch(const std::string& db, const std::string& table, handler fn) {
+				if (worker.joinable()) throw std::logic_error("Listener already started");
+
+				watches.push_back(watch_entry{ db, table, std::move(fn) });
+				return *this;
+			}
+
+			// invalidate the entries of `cache' tagged `tag' (the table name if empty) on every change to `db'.`table'
+			binlog_listener& invalidate(query_cache& cache, const std::string& db, const std::string& table, const std::string& tag = "") {
+				std::string t = tag.empty() ? table : tag;
+				return watch(db, table, [&cache, t](const std::string&, const std::string&, table_change) {
+					cache.invalidate(t);
+				});
+			}
+
+			void start() {
+				if (worker.joinable()) return;
+
+#ifndef MYSQL_RPL_SKIP_HEARTBEAT
+				throw std::runtime_error("The MySQL client library does not support reading binary logs");
+#endif
+
+				stopping = false;
+				failed = false;
+				worker = std::thread(&binlog_listener::run, this);
+			}
+
+			// stop following the log, within about `binlog_options::heartbeat'
+			void stop() {
+				if (!worker.joinable()) return;
+
+				{
+					std::lock_guard<std::mutex> lg(stop_mutex);
+					stopping = true;
+				}
+				stop_cv.notify_all();
+				worker.join();
+			}
+
+			// last error that interrupted reading, nullptr if none; reading is retried after
+			// `reconnect_delay', except after an access error (see `statistics::failed')
+			std::exception_ptr last_error() const {
+				std::lock_guard<std::mutex> lg(error_mutex);
+				return error;
+			}
+
+			statistics stats() const {
+				statistics res;
+				res.events = num_events.load();
+				res.row_events = num_row_events.load();
+				res.reconnects = num_reconnects.load();
+				res.failed = failed.load();
+
+				std::lock_guard<std::mutex> lg(position_mutex);
+				res.file = file;
+				res.position = position;
+				return res;
+			}
+		};
+	}
+}
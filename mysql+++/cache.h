@@ -0,0 +1,468 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <list>
+#include <iterator>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cctype>
+#include <stdexcept>
+
+#include "mysql+++.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		struct cache_options {
+			std::size_t max_bytes = 64 * 1024 * 1024;		// memory budget of all cached results
+			std::chrono::milliseconds ttl{ 60000 };			// default time to live of a cached result
+			unsigned int shards = 16;						// independently locked parts, each with 1/shards of the budget
+			std::string name = "default";					// `cache' label of the cache's metrics
+			metrics_registry* metrics = nullptr;
+		};
+
+
+		// read-only rows in a compact layout: the data of all fields in one buffer (each field followed
+		// by a '\0') and a table of offsets; the storage belongs to the derived class (`cached_result' in
+		// memory, `mapped_result' in a file). Being immutable, it can be read by many threads at once
+		//
+		// as with `result', empty fields read as NULL
+		class result_view {
+		protected:
+			unsigned int num_fields = 0;
+			std::size_t num_rows = 0;
+			const char* data = nullptr;
+			const std::uint64_t* offsets = nullptr;		// start of every field, row by row, then the end of the data
+
+
+			template <typename Value>
+			void fetch_impl(std::size_t row, int i, Value& value) const {
+				get_value(row, i, value);
+			}
+
+			template <typename Value, typename... Values>
+			void fetch_impl(std::size_t row, int i, Value& value, Values&... values) const {
+				get_value(row, i, value);
+				fetch_impl(row, i + 1, values...);
+			}
+
+			result_view() {}
+
+		public:
+			result_view(const result_view&) = delete;
+			void operator =(const result_view&) = delete;
+
+			virtual ~result_view() {}
+
+			std::size_t count() const {
+				return num_rows;
+			}
+
+			unsigned int fields() const {
+				return num_fields;
+			}
+
+			bool is_empty() const {
+				return num_rows == 0;
+			}
+
+			// bytes of field data, separators included
+			std::size_t data_size() const {
+				return offsets != nullptr ? offsets[num_rows * num_fields] : 0;
+			}
+
+			const char* get_field_data(std::size_t row, int i) const {
+				std::size_t k = row * num_fields + i;
+				if (offsets[k + 1] - offsets[k] <= 1) return nullptr;
+				return data + offsets[k];
+			}
+
+			std::size_t field_length(std::size_t row, int i) const {
+				std::size_t k = row * num_fields + i;
+				return offsets[k + 1] - offsets[k] - 1;
+			}
+
+			template <typename Value>
+			bool get_value(std::size_t row, int i, Value& value) const {
+				return parse_field(get_field_data(row, i), value);
+			}
+
+			// get data from every fields of row `row'
+			template <typename... Values>
+			bool fetch(std::size_t row, Values&... values) const {
+				if (row >= num_rows) return false;
+
+				fetch_impl(row, 0, values...);
+				return true;
+			}
+
+			// independent `result' with a copy of the rows, for code written against `result'
+			result to_result() const {
+				result res;
+				res.rows.resize(num_rows);
+				res.num_rows = num_rows;
+
+				std::size_t k = 0;
+				for (auto& row : res.rows) {
+					row.reserve(num_fields);
+					for (unsigned int i = 0; i < num_fields; i++, k++)
+						row.emplace_back(data + offsets[k], offsets[k + 1] - offsets[k] - 1);
+				}
+
+				res.num_fields = num_fields;
+				res.fetched = true;
+				return res;
+			}
+		};
+
+
+		// completely fetched result held in memory in the layout of `result_view'
+		class cached_result : public result_view {
+		protected:
+			std::string buffer;
+			std::vector<std::uint64_t> offset_table;
+
+		public:
+			// copy the rows of `res', fetching it if needed
+			cached_result(result& res) {
+				res.check_condition();
+
+				num_fields = res.num_fields;
+				num_rows = res.count_rows();
+
+				std::size_t total = 0, len;
+				for (std::size_t r = 0; r < num_rows; r++) {
+					for (unsigned int i = 0; i < num_fields; i++) {
+						res.field(r, i, len);
+						total += len + 1;
+					}
+				}
+
+				buffer.reserve(total);
+				offset_table.reserve(num_rows * num_fields + 1);
+				for (std::size_t r = 0; r < num_rows; r++) {
+					for (unsigned int i = 0; i < num_fields; i++) {
+						const char* field = res.field(r, i, len);
+						offset_table.push_back(buffer.size());
+						buffer.append(field, len);
+						buffer.push_back('\0');
+					}
+				}
+				offset_table.push_back(buffer.size());
+
+				data = buffer.data();
+				offsets = offset_table.data();
+			}
+
+			// bytes of memory held
+			std::size_t memory_size() const {
+				return sizeof(*this) + buffer.capacity() + offset_table.capacity() * sizeof(std::uint64_t);
+			}
+		};
+
+
+		// client-side cache of query results, keyed by the server and current database of the connection
+		// and the SQL text with its whitespace normalized (values formatted into the statement are part of
+		// the key); opt-in, by querying through the cache
+		//
+		// entries expire after their time to live and are evicted least recently used first beyond
+		// `max_bytes'; every entry can carry tags, typically the tables it reads, and `invalidate(tag)'
+		// drops the entries of a tag, including those whose query was running when it was called
+		//
+		// thread-safe: the cache is split into shards locked independently, and cached results are shared,
+		// never copied, between the threads reading them; concurrent misses on the same key each run the query
+		class query_cache {
+		public:
+			using clock = std::chrono::steady_clock;
+			using tag_list = std::vector<std::string>;
+
+			struct statistics {
+				unsigned long long hits;
+				unsigned long long misses;
+				unsigned long long evictions;			// entries dropped for the memory budget
+				unsigned long long expirations;			// entries found past their time to live
+				unsigned long long invalidations;		// entries found invalidated through one of their tags
+				std::size_t entries;
+				std::size_t bytes;
+			};
+
+		protected:
+			// tags are numbered by generation, incremented on invalidation; entries remember the
+			// generations of their tags as of before their query was sent
+			using tag_generation = std::atomic<unsigned long long>;
+			using tag_snapshot = std::vector<std::pair<const tag_generation*, unsigned long long>>;
+
+			struct entry {
+				std::string key;
+				std::shared_ptr<const cached_result> value;
+				clock::time_point expires;
+				tag_snapshot tags;
+				std::size_t size;
+			};
+
+			struct shard {
+				std::mutex mutex;
+				std::list<entry> lru;			// most recently used first
+				std::unordered_map<std::string, std::list<entry>::iterator> index;
+				std::size_t bytes = 0;
+				char padding[64];				// keeps the mutexes of neighbouring shards off the same cache line
+			};
+
+			cache_options options;
+			std::unique_ptr<shard[]> shards;
+			std::size_t shard_budget;
+
+			std::mutex tags_mutex;
+			std::unordered_map<std::string, std::unique_ptr<tag_generation>> tags;		// never shrinks, so pointers stay valid
+
+			std::atomic<unsigned long long> num_hits{ 0 };
+			std::atomic<unsigned long long> num_misses{ 0 };
+			std::atomic<unsigned long long> num_evictions{ 0 };
+			std::atomic<unsigned long long> num_expirations{ 0 };
+			std::atomic<unsigned long long> num_invalidations{ 0 };
+
+			metric_counter* hits_counter = nullptr;
+			metric_counter* misses_counter = nullptr;
+			metric_counter* evictions_counter = nullptr;
+			metric_gauge* bytes_gauge = nullptr;
+
+
+			shard& shard_of(const std::string& key) {
+				return shards[std::hash<std::string>()(key) % options.shards];
+			}
+
+			tag_snapshot snapshot(const tag_list& tag_names) {
+				tag_snapshot res;
+				if (tag_names.empty()) return res;
+
+				std::lock_guard<std::mutex> lg(tags_mutex);
+				for (auto& name : tag_names) {
+					auto& g = tags[name];
+					if (!g) g.reset(new tag_generation(0));
+					res.emplace_back(g.get(), g->load(std::memory_order_acquire));
+				}
+				return res;
+			}
+
+			static bool current(const entry& e) {
+				for (auto& t : e.tags)
+					if (t.first->load(std::memory_order_acquire) != t.second) return false;
+				return true;
+			}
+
+			void drop(shard& sh, std::list<entry>::iterator itr) {
+				sh.bytes -= itr->size;
+				if (bytes_gauge != nullptr) bytes_gauge->sub((long long)itr->size);
+				sh.index.erase(itr->key);
+				sh.lru.erase(itr);
+			}
+
+			void store(const std::string& key, std::shared_ptr<const cached_result> value, std::chrono::milliseconds ttl, tag_snapshot tag_gens) {
+				std::size_t size = sizeof(entry) + 2 * key.size() + value->memory_size() + tag_gens.size() * sizeof(tag_snapshot::value_type);
+				if (size > shard_budget) return;
+
+				shard& sh = shard_of(key);
+				std::lock_guard<std::mutex> lg(sh.mutex);
+
+				auto itr = sh.index.find(key);
+				if (itr != sh.index.end()) drop(sh, itr->second);
+
+				sh.lru.push_front(entry{ key, std::move(value), clock::now() + (ttl.count() > 0 ? ttl : options.ttl), std::move(tag_gens), size });
+				sh.index[key] = sh.lru.begin();
+				sh.bytes += size;
+				if (bytes_gauge != nullptr) bytes_gauge->add((long long)size);
+
+				while (sh.bytes > shard_budget) {
+					drop(sh, std::prev(sh.lru.end()));
+					num_evictions++;
+					if (evictions_counter != nullptr) evictions_counter->add();
+				}
+			}
+
+			std::shared_ptr<const cached_result> lookup(const std::string& key) {
+				shard& sh = shard_of(key);
+
+				{
+					std::lock_guard<std::mutex> lg(sh.mutex);
+
+					auto itr = sh.index.find(key);
+					if (itr != sh.index.end()) {
+						auto e = itr->second;
+
+						if (clock::now() >= e->expires) {
+							drop(sh, e);
+							num_expirations++;
+						}
+						else if (!current(*e)) {
+							drop(sh, e);
+							num_invalidations++;
+						}
+						else {
+							sh.lru.splice(sh.lru.begin(), sh.lru, e);
+							num_hits++;
+							if (hits_counter != nullptr) hits_counter->add();
+							return e->value;
+						}
+					}
+				}
+
+				num_misses++;
+				if (misses_counter != nullptr) misses_counter->add();
+				return nullptr;
+			}
+
+		public:
+			query_cache(const query_cache&) = delete;
+			void operator =(const query_cache&) = delete;
+
+			query_cache(const cache_options& opts = cache_options())
+				: options(opts)
+			{
+				if (options.shards == 0) options.shards = 1;
+				shards.reset(new shard[options.shards]);
+				shard_budget = options.max_bytes / options.shards;
+
+				if (options.metrics != nullptr) {
+					std::string labels = "cache=\"" + options.name + "\"";
+					hits_counter = &options.metrics->counter("cache_hits_total", "Queries answered from the result cache.", labels);
+					misses_counter = &options.metrics->counter("cache_misses_total", "Queries not found in the result cache.", labels);
+					evictions_counter = &options.metrics->counter("cache_evictions_total", "Cached results evicted for the memory budget.", labels);
+					bytes_gauge = &options.metrics->gauge("cache_bytes", "Memory held by cached results.", labels);
+				}
+			}
+
+			// cache key of a statement: runs of whitespace outside quotes collapsed to a single space, trimmed
+			static std::string normalize(const std::string& sql) {
+				std::string res;
+				res.reserve(sql.length());
+
+				char quote = 0;
+				bool space = false;
+				for (std::size_t i = 0; i < sql.length(); i++) {
+					char c = sql[i];
+
+					if (quote != 0) {
+						res += c;
+						if (c == '\\' && quote != '`' && i + 1 < sql.length()) res += sql[++i];
+						else if (c == quote) quote = 0;
+						continue;
+					}
+
+					if (std::isspace((unsigned char)c)) {
+						space = true;
+						continue;
+					}
+
+					if (space && !res.empty()) res += ' ';
+					space = false;
+
+					res += c;
+					if (c == '\'' || c == '"' || c == '`') quote = c;
+				}
+
+				return res;
+			}
+
+			// cache key of a statement run on `con': the same text names other tables in another database
+			// or on another server, and may show other rows to another user; a `USE' changes the current
+			// database only when the server tracks the schema (session_track_schema, on by default)
+			static std::string key_of(connection& con, const std::string& sql) {
+				const connect_options& opts = con.get_connect_options();
+				std::string res = opts.username + '@' + opts.server + ':' + std::to_string(opts.port) + '/' + con.current_database();
+
+				res += '\n';
+				res += normalize(sql);
+				return res;
+			}
+
+			// cached result of `query_str' on the server and database of `con', nullptr if not cached
+			std::shared_ptr<const cached_result> find(connection& con, const std::string& query_str) {
+				return lookup(key_of(con, query_str));
+			}
+
+			// cached result of `query_str', running it on `con' and caching its result on a miss;
+			// `ttl' of 0 stands for `cache_options::ttl'
+			std::shared_ptr<const cached_result> get(connection& con, const std::string& query_str, const tag_list& tag_names = tag_list(), std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+				std::string key = key_of(con, query_str);
+				auto res = lookup(key);
+				if (res) return res;
+
+				tag_snapshot tag_gens = snapshot(tag_names);
+
+				result r = con.query(query_str);
+				res = std::make_shared<cached_result>(r);
+
+				store(key, res, ttl, std::move(tag_gens));
+				return res;
+			}
+
+			// same as `get', as an independent `result'
+			result query(connection& con, const std::string& query_str, const tag_list& tag_names = tag_list(), std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+				return get(con, query_str, tag_names, ttl)->to_result();
+			}
+
+			// cache a result obtained elsewhere on `con'; its tags are taken as of now
+			std::shared_ptr<const cached_result> put(connection& con, const std::string& query_str, result& res, const tag_list& tag_names = tag_list(), std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+				auto cr = std::make_shared<const cached_result>(res);
+				store(key_of(con, query_str), cr, ttl, snapshot(tag_names));
+				return cr;
+			}
+
+			// drop the results tagged `tag', e.g. after writing to the table it names
+			void invalidate(const std::string& tag) {
+				std::lock_guard<std::mutex> lg(tags_mutex);
+
+				auto itr = tags.find(tag);
+				if (itr != tags.end()) itr->second->fetch_add(1, std::memory_order_acq_rel);
+			}
+
+			void invalidate(const tag_list& tag_names) {
+				for (auto& tag : tag_names)
+					invalidate(tag);
+			}
+
+			// drop every cached result
+			void clear() {
+				for (unsigned int i = 0; i < options.shards; i++) {
+					shard& sh = shards[i];
+					std::lock_guard<std::mutex> lg(sh.mutex);
+
+					if (bytes_gauge != nullptr) bytes_gauge->sub((long long)sh.bytes);
+					sh.lru.clear();
+					sh.index.clear();
+					sh.bytes = 0;
+				}
+			}
+
+			statistics stats() {
+				statistics res;
+				res.hits = num_hits.load();
+				res.misses = num_misses.load();
+				res.evictions = num_evictions.load();
+				res.expirations = num_expirations.load();
+				res.invalidations = num_invalidations.load();
+				res.entries = 0;
+				res.bytes = 0;
+
+				for (unsigned int i = 0; i < options.shards; i++) {
+					shard& sh = shards[i];
+					std::lock_guard<std::mutex> lg(sh.mutex);
+					res.entries += sh.lru.size();
+					res.bytes += sh.bytes;
+				}
+				return res;
+			}
+
+			const cache_options& get_options() const {
+				return options;
+			}
+		};
+	}
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <stdexcept>
+
+#include "mysql+++.h"
+#include "lockfree.h"
+#include "transaction.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		namespace writer_detail {
+			// a value rendered on the caller's thread; strings are escaped later by the writer thread,
+			// which is the only one allowed to touch the connection
+			struct field {
+				enum kind_type {
+					null_value,
+					number_value,
+					string_value
+				};
+
+				kind_type kind;
+				std::string text;
+			};
+
+			inline field make_field(std::nullptr_t) {
+				return field{ field::null_value, std::string() };
+			}
+
+			inline field make_field(bool value) {
+				return field{ field::number_value, value ? "1" : "0" };
+			}
+
+			inline field make_field(const std::string& value) {
+				return field{ field::string_value, value };
+			}
+
+			inline field make_field(const char* value) {
+				if (value == nullptr) return make_field(nullptr);
+				return field{ field::string_value, value };
+			}
+
+			inline field make_field(const datetime& value) {
+				return field{ field::string_value, value.to_sql() };
+			}
+
+			template <typename T>
+			typename std::enable_if<std::is_integral<T>::value, field>::type
+				make_field(T value) {
+				return field{ field::number_value, std::to_string(value) };
+			}
+
+			// NaN and infinities have no SQL literal, and would fail the whole batch of every caller
+			template <typename T>
+			typename std::enable_if<std::is_floating_point<T>::value, field>::type
+				make_field(T value) {
+				if (!std::isfinite(value)) throw std::invalid_argument("Non-finite value cannot be written");
+
+				char buf[64];
+				std::snprintf(buf, sizeof(buf), "%.17Lg", (long double)value);
+				return field{ field::number_value, buf };
+			}
+
+			template <typename T>
+			field make_field(const optional<T>& value) {
+				if (!value) return make_field(nullptr);
+				return make_field(*value);
+			}
+		}
+
+
+		struct coalescing_writer_options {
+			std::size_t max_rows = 1000;						// commit once this many rows are pending
+			std::size_t max_bytes = 1024 * 1024;				// split statements at this size (keep below max_allowed_packet)
+			std::chrono::milliseconds max_delay{ 10 };			// commit rows at latest this long after they were queued
+		};
+
+
+		// write-behind inserter: rows queued from any number of threads are coalesced into
+		// multi-row INSERT statements and committed in one transaction per batch
+		//
+		// the writer thread owns the connection while the writer is alive; `flush()' returns a future
+		// that becomes ready once every row queued before it has been committed, or holds the error
+		// if any of those rows failed to be written
+		class coalescing_writer {
+		protected:
+			struct entry {
+				std::vector<writer_detail::field> fields;
+				std::shared_ptr<std::promise<void>> flushed;	// set for flush requests instead of a row
+			};
+
+			using clock = std::chrono::steady_clock;
+
+			connection& con;
+			std::string insert_prefix;
+			std::size_t num_columns;
+			coalescing_writer_options options;
+
+			mpsc_queue<entry> queue;
+			std::atomic<std::size_t> pending{ 0 };			// rows queued and not yet taken by the writer thread
+			std::atomic<unsigned int> flush_requests{ 0 };
+			std::atomic<bool> stopping{ false };
+
+			std::mutex wake_mutex;
+			std::condition_variable wake;
+
+			// owned by the writer thread
+			std::string statement;
+			std::vector<std::string> statements;
+			std::size_t batch_rows = 0;
+			clock::time_point batch_start;
+			std::vector<std::shared_ptr<std::promise<void>>> waiters;
+			std::exception_ptr batch_error;
+
+			std::atomic<unsigned long long> num_rows_written{ 0 };
+			std::atomic<unsigned long long> num_rows_failed{ 0 };
+			std::atomic<unsigned long long> num_batches{ 0 };
+
+			std::thread worker;
+
+
+			void append_row(const std::vector<writer_detail::field>& fields) {
+				if (batch_rows == 0) batch_start = clock::now();
+
+				if (statement.empty()) statement = insert_prefix;
+				else statement += ',';
+
+				statement += '(';
+				for (std::size_t i = 0; i < fields.size(); i++) {
+					if (i > 0) statement += ',';
+
+					const writer_detail::field& f = fields[i];
+					switch (f.kind) {
+					case writer_detail::field::null_value:
+						statement += "NULL";
+						break;
+					case writer_detail::field::number_value:
+						statement += f.text;
+						break;
+					case writer_detail::field::string_value:
+						statement += '\'';
+						statement += con.escape_string(f.text);
+						statement += '\'';
+						break;
+					}
+				}
+				statement += ')';
+
+				batch_rows++;
+				if (statement.length() >= options.max_bytes) {
+					statements.push_back(std::move(statement));
+					statement.clear();
+				}
+			}
+
+			// commit all pending rows in one transaction, then answer the flush requests covered by it
+			void commit() {
+				if (!statement.empty()) {
+					statements.push_back(std::move(statement));
+					statement.clear();
+				}
+
+				if (!statements.empty()) {
+					try {
+						transaction tx(con);
+						for (auto& st : statements)
+							con.exec(st);
+						tx.commit();
+
+						num_rows_written += batch_rows;
+						num_batches++;
+					}
+					catch (...) {
+						batch_error = std::current_exception();
+						num_rows_failed += batch_rows;
+					}
+
+					statements.clear();
+					batch_rows = 0;
+				}
+
+				if (!waiters.empty()) {
+					for (auto& w : waiters) {
+						if (batch_error) w->set_exception(batch_error);
+						else w->set_value();
+					}
+
+					waiters.clear();
+					batch_error = nullptr;
+				}
+			}
+
+			void run() {
+				thread_init_guard tg;
+
+				while (true) {
+					bool stop = stopping.load();
+
+					entry e;
+					while (queue.try_pop(e)) {
+						if (e.flushed) {
+							flush_requests--;
+							waiters.push_back(std::move(e.flushed));
+							commit();
+							continue;
+						}
+
+						pending--;
+						append_row(e.fields);
+						if (batch_rows >= options.max_rows) commit();
+					}
+
+					if (batch_rows > 0 && (stop || clock::now() - batch_start >= options.max_delay))
+						commit();
+
+					// rows pushed concurrently with the stop request are drained by the loop above
+					if (stop && pending.load() == 0 && flush_requests.load() == 0) break;
+
+					std::unique_lock<std::mutex> lk(wake_mutex);
+					auto delay = options.max_delay;
+					if (batch_rows > 0) delay = std::chrono::duration_cast<std::chrono::milliseconds>(batch_start + options.max_delay - clock::now());
+
+					wake.wait_for(lk, delay, [this] {
+						return stopping.load() || flush_requests.load() > 0 || pending.load() >= options.max_rows;
+					});
+				}
+			}
+
+			void notify() {
+				{ std::lock_guard<std::mutex> lg(wake_mutex); }
+				wake.notify_one();
+			}
+
+		public:
+			coalescing_writer(const coalescing_writer&) = delete;
+			void operator =(const coalescing_writer&) = delete;
+
+			// `table' and `columns' are used as given, they are not escaped
+			coalescing_writer(connection& pcon, const std::string& table, const std::vector<std::string>& columns, const coalescing_writer_options& opts = coalescing_writer_options())
+				: con(pcon), num_columns(columns.size()), options(opts)
+			{
+				insert_prefix = "insert into " + table + " (";
+				for (std::size_t i = 0; i < columns.size(); i++) {
+					if (i > 0) insert_prefix += ',';
+					insert_prefix += columns[i];
+				}
+				insert_prefix += ") values ";
+
+				worker = std::thread(&coalescing_writer::run, this);
+			}
+
+			virtual ~coalescing_writer() {
+				close();
+			}
+
+			// queue a row, callable from any thread; throws once the writer is closed, and
+			// std::invalid_argument for a NaN or infinite value
+			template <typename... Values>
+			void insert(const Values&... values) {
+				if (sizeof...(Values) != num_columns)
+					throw std::invalid_argument("Number of values does not match number of columns");
+
+				entry e;
+				e.fields = { writer_detail::make_field(values)... };
+
+				// counted before checking `stopping': the worker does not exit while a row is pending
+				bool full = (++pending == options.max_rows);
+				if (stopping.load()) {
+					pending--;
+					throw std::logic_error("Writer already closed");
+				}
+				queue.push(std::move(e));
+				if (full) notify();
+			}
+
+			// return a future that is ready once every row queued before this call has been committed;
+			// throws once the writer is closed
+			std::future<void> flush() {
+				entry e;
+				e.flushed = std::make_shared<std::promise<void>>();
+				std::future<void> res = e.flushed->get_future();
+
+				flush_requests++;
+				if (stopping.load()) {
+					flush_requests--;
+					throw std::logic_error("Writer already closed");
+				}
+				queue.push(std::move(e));
+				notify();
+
+				return res;
+			}
+
+			// commit everything still queued and stop the writer thread
+			void close() {
+				if (!worker.joinable()) return;
+
+				stopping = true;
+				notify();
+				worker.join();
+			}
+
+			unsigned long long rows_written() const {
+				return num_rows_written;
+			}
+
+			unsigned long long rows_failed() const {
+				return num_rows_failed;
+			}
+
+			unsigned long long batches_committed() const {
+				return num_batches;
+			}
+		};
+	}
+}
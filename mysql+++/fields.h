@@ -0,0 +1,153 @@
+#pragma once
+
+
+#include <tuple>
+#include <vector>
+#include <cctype>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+
+namespace daotk {
+	namespace mysql {
+
+		// member `member' of `Struct', read from the column named `name'
+		template <typename Struct, typename Value>
+		struct field_descriptor {
+			using struct_type = Struct;
+			using value_type = Value;
+
+			const char* name;
+			Value Struct::* member;
+		};
+
+		template <typename Struct, typename Value>
+		constexpr field_descriptor<Struct, Value> describe_field(const char* name, Value Struct::* member) {
+			return field_descriptor<Struct, Value>{ name, member };
+		}
+
+
+		// true for structs declaring their fields, i.e. with a static `mysqlpp_fields()' returning a tuple
+		// of `field_descriptor' (written by hand or by MYSQLPP_FIELDS)
+		template <typename T, typename = void>
+		struct has_fields : std::false_type {};
+
+		template <typename T>
+		struct has_fields<T, decltype((void)T::mysqlpp_fields())> : std::true_type {};
+
+
+		namespace fields_detail {
+			template <typename Struct>
+			using table_type = decltype(Struct::mysqlpp_fields());
+
+			template <typename Table, typename Function, std::size_t... I>
+			void for_each(const Table& table, Function& fn, std::index_sequence<I...>) {
+				int dummy[] = { 0, (fn(std::get<I>(table), I), 0)... };
+				(void)dummy;
+			}
+
+			// identifies `Struct' for results caching the columns of its fields
+			template <typename Struct>
+			const void* type_key() {
+				static const char key = 0;
+				return &key;
+			}
+
+			// column names compare case-insensitively, as in SQL
+			inline bool same_name(const char* a, const char* b) {
+				for (; *a != '\0' && *b != '\0'; a++, b++)
+					if (std::tolower((unsigned char)*a) != std::tolower((unsigned char)*b)) return false;
+				return *a == *b;
+			}
+		}
+
+
+		template <typename Struct>
+		constexpr std::size_t field_count() {
+			return std::tuple_size<fields_detail::table_type<Struct>>::value;
+		}
+
+		// call `fn(descriptor, index)' for every field of `Struct', in declaration order
+		template <typename Struct, typename Function>
+		void for_each_field(Function&& fn) {
+			fields_detail::for_each(Struct::mysqlpp_fields(), fn, std::make_index_sequence<field_count<Struct>()>{});
+		}
+
+		// column of every field of `Struct' among `num_columns' columns named `name_of(c)', -1 for fields
+		// without a column; done once per result, so that rows are then decoded by position
+		template <typename Struct, typename Name>
+		void match_columns(unsigned int num_columns, Name name_of, std::vector<int>& columns) {
+			columns.assign(field_count<Struct>(), -1);
+			for_each_field<Struct>([&](const auto& field, std::size_t k) {
+				for (unsigned int c = 0; c < num_columns; c++) {
+					if (fields_detail::same_name(field.name, name_of(c))) {
+						columns[k] = (int)c;
+						break;
+					}
+				}
+			});
+		}
+	}
+}
+
+
+// declare the fields of a struct, read from the columns of the same names:
+//
+//	struct person {
+//		int id;
+//		std::string name;
+//		optional<double> weight;
+//
+//		MYSQLPP_FIELDS(person, id, name, weight)
+//	};
+//
+// up to 32 fields; beyond, or to read a column of another name, write `mysqlpp_fields()' by hand with
+// `describe_field("column", &person::member)'
+
+#define MYSQLPP_EXPAND(x) x
+#define MYSQLPP_CONCAT_(a, b) a##b
+#define MYSQLPP_CONCAT(a, b) MYSQLPP_CONCAT_(a, b)
+
+#define MYSQLPP_FIELD(S, m) ::daotk::mysql::describe_field(#m, &S::m)
+
+#define MYSQLPP_FIELDS_1(S, m) MYSQLPP_FIELD(S, m)
+#define MYSQLPP_FIELDS_2(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_1(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_3(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_2(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_4(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_3(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_5(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_4(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_6(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_5(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_7(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_6(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_8(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_7(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_9(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_8(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_10(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_9(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_11(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_10(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_12(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_11(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_13(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_12(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_14(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_13(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_15(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_14(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_16(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_15(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_17(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_16(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_18(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_17(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_19(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_18(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_20(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_19(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_21(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_20(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_22(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_21(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_23(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_22(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_24(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_23(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_25(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_24(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_26(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_25(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_27(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_26(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_28(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_27(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_29(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_28(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_30(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_29(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_31(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_30(S, __VA_ARGS__))
+#define MYSQLPP_FIELDS_32(S, m, ...) MYSQLPP_FIELD(S, m), MYSQLPP_EXPAND(MYSQLPP_FIELDS_31(S, __VA_ARGS__))
+
+#define MYSQLPP_FIELDS_COUNT_(S, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define MYSQLPP_FIELDS_COUNT(...) MYSQLPP_EXPAND(MYSQLPP_FIELDS_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0))
+
+#define MYSQLPP_FIELDS(S, ...) \
+	static auto mysqlpp_fields() { \
+		return std::make_tuple(MYSQLPP_EXPAND(MYSQLPP_CONCAT(MYSQLPP_FIELDS_, MYSQLPP_FIELDS_COUNT(S, __VA_ARGS__))(S, __VA_ARGS__))); \
+	}
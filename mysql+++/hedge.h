@@ -0,0 +1,342 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <deque>
+
+#include "mysql+++.h"
+#include "replication.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		struct hedge_options {
+			double percentile = 0.95;								// hedge reads slower than this percentile of recent reads
+			std::chrono::microseconds initial_delay{ 10000 };		// until enough reads have been measured
+			std::chrono::microseconds min_delay{ 1000 };
+			std::chrono::microseconds max_delay{ 1000000 };
+			std::size_t window = 1000;								// reads per latency measurement window
+			double max_hedge_ratio = 0.05;							// at most this fraction of reads is hedged
+			std::size_t threads = 16;								// attempt threads; each read uses one or two
+		};
+
+
+		// hedged reads over the replicas of a `rw_router': a read is sent to one replica and, if it has not
+		// answered after the `percentile' latency of recent reads, to a second one; the first result is used
+		// and the query still running on the other replica is interrupted with KILL QUERY
+		//
+		// hedges are limited to `max_hedge_ratio' of the reads by a token bucket, so a slow cluster is not
+		// loaded twice; attempts run on a fixed set of `threads' worker threads, and the router must outlive the reader
+		class hedged_reader {
+		public:
+			struct statistics {
+				unsigned long long reads;
+				unsigned long long hedges;				// second requests sent
+				unsigned long long hedge_wins;			// reads answered first by the second request
+				unsigned long long suppressed;			// hedges not sent because of `max_hedge_ratio'
+				unsigned long long cancellations;		// slower requests interrupted with KILL QUERY, or dropped before running
+				std::chrono::microseconds delay;		// current hedging delay
+			};
+
+		protected:
+			// one hedged read, shared by the caller and the attempt threads
+			struct read_state {
+				std::mutex mutex;
+				std::condition_variable cv;
+				std::string query_str;
+
+				bool done = false;
+				result res;
+				std::exception_ptr error;
+				std::size_t winner = 0;
+				unsigned int launched = 0;
+				unsigned int failed = 0;
+				bool kill_pending = false;			// the winner is sending KILL QUERY to the other attempt
+
+				struct attempt {
+					std::size_t replica = 0;
+					unsigned long thread_id = 0;		// server thread running the query, 0 until known
+					bool finished = false;
+				} attempts[2];
+			};
+
+			rw_router& router;
+			hedge_options options;
+
+			latency_histogram latencies;
+			std::mutex window_mutex;
+			std::atomic<long long> delay_us;
+
+			static const long long token = 1000000;
+			std::atomic<long long> budget{ token };		// hedges allowed, in millionths
+
+			std::atomic<unsigned long long> num_reads{ 0 };
+			std::atomic<unsigned long long> num_hedges{ 0 };
+			std::atomic<unsigned long long> num_hedge_wins{ 0 };
+			std::atomic<unsigned long long> num_suppressed{ 0 };
+			std::atomic<unsigned long long> num_cancellations{ 0 };
+
+			metric_counter* hedges_counter = nullptr;
+			metric_counter* suppressed_counter = nullptr;
+			metric_counter* wins_counter = nullptr;
+			metric_counter* cancellations_counter = nullptr;
+
+			// attempts waiting for a worker thread; the queue is drained before the workers exit
+			std::mutex tasks_mutex;
+			std::condition_variable tasks_cv;
+			std::deque<std::pair<std::shared_ptr<read_state>, unsigned int>> tasks;
+			bool closing = false;
+			std::vector<std::thread> workers;
+
+
+			void record_latency(std::chrono::nanoseconds d) {
+				latencies.record(d);
+				if (latencies.count() < options.window) return;
+
+				std::lock_guard<std::mutex> lg(window_mutex);
+				if (latencies.count() < options.window) return;
+
+				auto p = std::chrono::duration_cast<std::chrono::microseconds>(latencies.percentile(options.percentile));
+				p = (std::max)(options.min_delay, (std::min)(options.max_delay, p));
+				delay_us.store(p.count(), std::memory_order_relaxed);
+				latencies.reset();
+			}
+
+			// add the share of one read to the hedge budget, capped to a small burst
+			void refill() {
+				long long add = (long long)(options.max_hedge_ratio * token);
+				long long b = budget.load(std::memory_order_relaxed);
+				while (b < 10 * token && !budget.compare_exchange_weak(b, (std::min)(b + add, 10 * token), std::memory_order_relaxed));
+			}
+
+			bool take_hedge() {
+				long long b = budget.load(std::memory_order_relaxed);
+				while (b >= token)
+					if (budget.compare_exchange_weak(b, b - token, std::memory_order_relaxed)) return true;
+				return false;
+			}
+
+			// `st->mutex' must be held
+			void launch(std::shared_ptr<read_state> st, unsigned int i) {
+				st->launched++;
+				{
+					std::lock_guard<std::mutex> lg(tasks_mutex);
+					tasks.emplace_back(std::move(st), i);
+				}
+				tasks_cv.notify_one();
+			}
+
+			void run_worker() {
+				thread_init_guard tg;
+
+				std::unique_lock<std::mutex> lk(tasks_mutex);
+				while (true) {
+					tasks_cv.wait(lk, [this] { return closing || !tasks.empty(); });
+					if (tasks.empty()) break;
+
+					auto task = std::move(tasks.front());
+					tasks.pop_front();
+
+					lk.unlock();
+					run_attempt(task.first, task.second);
+					lk.lock();
+				}
+			}
+
+			// the read was answered before attempt `i' got its connection: it is not sent at all
+			void drop(read_state& st, unsigned int i) {
+				st.attempts[i].finished = true;
+				num_cancellations++;
+				if (cancellations_counter != nullptr) cancellations_counter->add();
+			}
+
+			// record the failure of attempt `i'; `st->mutex' must be held
+			static void fail(read_state& st, unsigned int i) {
+				st.attempts[i].finished = true;
+				st.failed++;
+				if (!st.error) st.error = std::current_exception();
+			}
+
+			void run_attempt(std::shared_ptr<read_state> st, unsigned int i) {
+				auto start = std::chrono::steady_clock::now();
+
+				try {
+					{
+						std::lock_guard<std::mutex> lg(st->mutex);
+						if (st->done) {
+							drop(*st, i);
+							return;
+						}
+					}
+
+					pooled_connection pc = router.replica_pool(st->attempts[i].replica).acquire();
+
+					// the winner only kills attempts whose server thread is known; one that finished while
+					// this attempt was still connecting left it to check `done' here instead
+					{
+						std::lock_guard<std::mutex> lg(st->mutex);
+						if (st->done) {
+							drop(*st, i);
+							return;
+						}
+						st->attempts[i].thread_id = pc->server_thread_id();
+					}
+
+					// `finished' is set before `pc' is given back on both paths: once set, the other attempt no
+					// longer kills this connection's server thread, whose id may be reused after the release
+					std::size_t other_replica = 0;
+					unsigned long kill_id = 0;
+					try {
+						result res = pc->query(st->query_str);
+						res.count();
+
+						std::unique_lock<std::mutex> lk(st->mutex);
+						st->attempts[i].finished = true;
+
+						if (!st->done) {
+							st->done = true;
+							st->winner = i;
+							st->res = std::move(res);
+							record_latency(std::chrono::steady_clock::now() - start);
+
+							unsigned int o = 1 - i;
+							if (o < st->launched && !st->attempts[o].finished && st->attempts[o].thread_id != 0) {
+								other_replica = st->attempts[o].replica;
+								kill_id = st->attempts[o].thread_id;
+								st->kill_pending = true;
+							}
+						}
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> lg(st->mutex);
+						fail(*st, i);
+					}
+					st->cv.notify_all();
+
+					// the caller already has its result: the KILL is sent without holding the lock
+					if (kill_id != 0) {
+						try {
+							pooled_connection killer = router.replica_pool(other_replica).acquire();
+							killer->exec("kill query " + std::to_string(kill_id));
+							num_cancellations++;
+							if (cancellations_counter != nullptr) cancellations_counter->add();
+						}
+						catch (...) {}
+
+						std::lock_guard<std::mutex> lg(st->mutex);
+						st->kill_pending = false;
+						st->cv.notify_all();
+					}
+
+					// the slower attempt keeps its connection until the KILL aimed at it has been sent
+					std::unique_lock<std::mutex> lk(st->mutex);
+					st->cv.wait(lk, [&] { return !st->kill_pending; });
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lg(st->mutex);
+					fail(*st, i);
+					st->cv.notify_all();
+				}
+			}
+
+		public:
+			hedged_reader(const hedged_reader&) = delete;
+			void operator =(const hedged_reader&) = delete;
+
+			hedged_reader(rw_router& _router, const hedge_options& opts = hedge_options(), metrics_registry* metrics = nullptr)
+				: router(_router), options(opts), delay_us(opts.initial_delay.count())
+			{
+				if (metrics != nullptr) {
+					hedges_counter = &metrics->counter("hedged_reads_total", "Reads sent to a second replica.");
+					suppressed_counter = &metrics->counter("hedges_suppressed_total", "Hedges not sent because of the hedge rate limit.");
+					wins_counter = &metrics->counter("hedge_wins_total", "Hedged reads answered first by the second replica.");
+					cancellations_counter = &metrics->counter("hedge_cancellations_total", "Slower hedged requests interrupted with KILL QUERY or dropped.");
+				}
+
+				std::size_t n = (std::max)(options.threads, (std::size_t)2);
+				for (std::size_t i = 0; i < n; i++)
+					workers.emplace_back(&hedged_reader::run_worker, this);
+			}
+
+			virtual ~hedged_reader() {
+				{
+					std::lock_guard<std::mutex> lg(tasks_mutex);
+					closing = true;
+				}
+				tasks_cv.notify_all();
+
+				for (auto& w : workers)
+					w.join();
+			}
+
+			// read-only query, fully fetched; falls back to a plain read when no replica is available
+			result query(const std::string& query_str) {
+				num_reads++;
+				refill();
+
+				std::size_t first = router.select_replica();
+				if (first == rw_router::npos) return router.query(query_str);
+
+				auto st = std::make_shared<read_state>();
+				st->query_str = query_str;
+				st->attempts[0].replica = first;
+
+				std::unique_lock<std::mutex> lk(st->mutex);
+				launch(st, 0);
+
+				auto delay = std::chrono::microseconds(delay_us.load(std::memory_order_relaxed));
+				st->cv.wait_for(lk, delay, [&] { return st->done || st->failed == st->launched; });
+
+				if (!st->done && st->failed < st->launched) {
+					std::size_t second = router.select_replica(first);
+					if (second != rw_router::npos) {
+						if (take_hedge()) {
+							st->attempts[1].replica = second;
+							launch(st, 1);
+							num_hedges++;
+							if (hedges_counter != nullptr) hedges_counter->add();
+						}
+						else {
+							num_suppressed++;
+							if (suppressed_counter != nullptr) suppressed_counter->add();
+						}
+					}
+				}
+
+				st->cv.wait(lk, [&] { return st->done || st->failed == st->launched; });
+				if (!st->done) std::rethrow_exception(st->error);
+
+				if (st->winner == 1) {
+					num_hedge_wins++;
+					if (wins_counter != nullptr) wins_counter->add();
+				}
+				return std::move(st->res);
+			}
+
+			template <typename... Values>
+			result query(const std::string& fmt_str, Values... values) {
+				return query(format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			statistics stats() const {
+				statistics res;
+				res.reads = num_reads.load();
+				res.hedges = num_hedges.load();
+				res.hedge_wins = num_hedge_wins.load();
+				res.suppressed = num_suppressed.load();
+				res.cancellations = num_cancellations.load();
+				res.delay = std::chrono::microseconds(delay_us.load(std::memory_order_relaxed));
+				return res;
+			}
+		};
+	}
+}
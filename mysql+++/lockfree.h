@@ -0,0 +1,214 @@
+#pragma once
+
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+
+
+namespace daotk {
+	namespace mysql {
+
+		// size used to keep independently written atomics on separate cache lines
+		static const std::size_t cache_line_size = 64;
+
+
+		// spin-then-sleep waiting strategy used by the lock-free queues below
+		class backoff {
+		protected:
+			unsigned int spins = 0;
+
+		public:
+			void wait() {
+				if (spins < 64) std::this_thread::yield();
+				else std::this_thread::sleep_for(std::chrono::microseconds(50));
+				spins++;
+			}
+
+			void reset() {
+				spins = 0;
+			}
+		};
+
+
+		// bounded single-producer/single-consumer ring buffer
+		// (capacity is rounded up to a power of two, T must be default-constructible)
+		template <typename T>
+		class spsc_ring {
+		protected:
+			std::unique_ptr<T[]> slots;
+			std::size_t mask;
+
+			alignas(cache_line_size) std::atomic<std::size_t> head{ 0 };	// next slot to read, written by consumer
+			std::size_t cached_tail = 0;
+
+			alignas(cache_line_size) std::atomic<std::size_t> tail{ 0 };	// next slot to write, written by producer
+			std::size_t cached_head = 0;
+
+		public:
+			spsc_ring(const spsc_ring&) = delete;
+			void operator =(const spsc_ring&) = delete;
+
+			explicit spsc_ring(std::size_t capacity) {
+				std::size_t size = 2;
+				while (size < capacity) size <<= 1;
+
+				slots.reset(new T[size]);
+				mask = size - 1;
+			}
+
+			std::size_t capacity() const {
+				return mask + 1;
+			}
+
+			// producer side: return false if the ring is full
+			bool try_push(T&& value) {
+				std::size_t t = tail.load(std::memory_order_relaxed);
+				if (t - cached_head > mask) {
+					cached_head = head.load(std::memory_order_acquire);
+					if (t - cached_head > mask) return false;
+				}
+
+				slots[t & mask] = std::move(value);
+				tail.store(t + 1, std::memory_order_release);
+				return true;
+			}
+
+			// consumer side: return false if the ring is empty
+			bool try_pop(T& value) {
+				std::size_t h = head.load(std::memory_order_relaxed);
+				if (h == cached_tail) {
+					cached_tail = tail.load(std::memory_order_acquire);
+					if (h == cached_tail) return false;
+				}
+
+				value = std::move(slots[h & mask]);
+				head.store(h + 1, std::memory_order_release);
+				return true;
+			}
+
+			bool empty() const {
+				return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+			}
+
+			// number of values in the ring, exact on either side when the other one is not running
+			std::size_t size() const {
+				std::size_t h = head.load(std::memory_order_acquire);
+				return tail.load(std::memory_order_acquire) - h;
+			}
+		};
+
+
+		// unbounded multi-producer/single-consumer queue (Vyukov's node-based algorithm):
+		// push() is a single atomic exchange, so producers never block each other
+		// (T must be default-constructible)
+		template <typename T>
+		class mpsc_queue {
+		protected:
+			struct node {
+				std::atomic<node*> next{ nullptr };
+				T value;
+			};
+
+			alignas(cache_line_size) std::atomic<node*> head;	// last pushed node, written by producers
+			alignas(cache_line_size) node* tail;				// consumed stub node, owned by consumer
+
+		public:
+			mpsc_queue(const mpsc_queue&) = delete;
+			void operator =(const mpsc_queue&) = delete;
+
+			mpsc_queue() {
+				node* stub = new node();
+				head.store(stub, std::memory_order_relaxed);
+				tail = stub;
+			}
+
+			~mpsc_queue() {
+				while (tail != nullptr) {
+					node* next = tail->next.load(std::memory_order_relaxed);
+					delete tail;
+					tail = next;
+				}
+			}
+
+			// producer side, callable from any thread
+			void push(T&& value) {
+				node* n = new node();
+				n->value = std::move(value);
+
+				node* prev = head.exchange(n, std::memory_order_acq_rel);
+				prev->next.store(n, std::memory_order_release);
+			}
+
+			// consumer side: return false if the queue is empty
+			// (or if a producer is still in the middle of linking its node)
+			bool try_pop(T& value) {
+				node* next = tail->next.load(std::memory_order_acquire);
+				if (next == nullptr) return false;
+
+				value = std::move(next->value);
+				delete tail;
+				tail = next;
+				return true;
+			}
+		};
+
+
+		// shared pointer read by any number of threads without locks and replaced by one writer at a time
+		// (std::atomic_load on a shared_ptr takes a lock from a hidden pool): a reader counts itself in
+		// one of two counters, picked by the epoch, while it copies the pointer; the writer swaps in a new
+		// holder, then flips the epoch twice, each time waiting for the readers of the other counter to
+		// leave, before deleting the old holder. Readers never wait, the writer only for copies in progress
+		template <typename T>
+		class published_ptr {
+		protected:
+			struct holder {
+				std::shared_ptr<T> ptr;
+			};
+
+			std::atomic<holder*> current;
+			std::atomic<unsigned int> epoch{ 0 };
+			alignas(cache_line_size) mutable std::atomic<std::size_t> readers[2];
+
+		public:
+			published_ptr(const published_ptr&) = delete;
+			void operator =(const published_ptr&) = delete;
+
+			explicit published_ptr(std::shared_ptr<T> p = nullptr)
+				: current(new holder{ std::move(p) })
+			{
+				readers[0].store(0);
+				readers[1].store(0);
+			}
+
+			~published_ptr() {
+				delete current.load();
+			}
+
+			// callable from any thread
+			std::shared_ptr<T> load() const {
+				std::atomic<std::size_t>& r = readers[epoch.load() & 1];
+				r.fetch_add(1);
+				std::shared_ptr<T> res = current.load()->ptr;
+				r.fetch_sub(1);
+				return res;
+			}
+
+			// callers must be serialized
+			void store(std::shared_ptr<T> p) {
+				holder* old = current.exchange(new holder{ std::move(p) });
+
+				// a reader still copying from `old' has been counted since before the exchange
+				for (int i = 0; i < 2; i++) {
+					unsigned int e = epoch.fetch_add(1);
+
+					backoff b;
+					while (readers[e & 1].load() != 0) b.wait();
+				}
+				delete old;
+			}
+		};
+	}
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mysql+++.h"
+#include "cache.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		namespace mapped_detail {
+			// file layout: header, freshness token padded to 8 bytes, offset table, field data
+			// (the layout of `result_view', so that a mapped file is read in place)
+			struct file_header {
+				char magic[8];
+				std::uint32_t format_version;
+				std::uint32_t byte_order;				// `byte_order_mark' as written, files of another byte order are rejected
+				std::uint64_t num_rows;
+				std::uint32_t num_fields;
+				std::uint32_t freshness_length;
+				std::uint64_t data_size;
+				std::int64_t created;					// seconds since the epoch
+			};
+
+			const char magic[8] = { 'M', 'Y', 'S', 'Q', 'L', 'P', 'P', 'R' };
+			const std::uint32_t format_version = 2;			// 2: 64-bit offsets
+			const std::uint32_t byte_order_mark = 0x01020304;
+
+			inline std::size_t padded(std::size_t n) {
+				return (n + 7) & ~(std::size_t)7;
+			}
+
+			inline void write(std::FILE* f, const void* p, std::size_t n, const std::string& path) {
+				if (n > 0 && std::fwrite(p, 1, n, f) != n) {
+					std::fclose(f);
+					throw std::runtime_error("Failed to write " + path);
+				}
+			}
+
+			// new file with a unique name in the directory of `path', so that concurrent writers of `path'
+			// never share it; its name is stored in `tmp_path'
+			inline std::FILE* create_temp(const std::string& path, std::string& tmp_path) {
+#ifdef _WIN32
+				std::size_t slash = path.find_last_of("\\/");
+				std::string dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+
+				char name[MAX_PATH];
+				if (GetTempFileNameA(dir.c_str(), "mpp", 0, name) == 0) throw std::runtime_error("Failed to create a file beside " + path);
+				tmp_path = name;
+
+				std::FILE* f = std::fopen(name, "wb");
+				if (f == nullptr) std::remove(name);
+#else
+				tmp_path = path + ".XXXXXX";
+				int fd = mkstemp(&tmp_path[0]);
+				if (fd < 0) throw std::runtime_error("Failed to create " + tmp_path);
+
+				// mkstemp creates the file readable by its owner only; `path' is meant to be mapped by other processes
+				fchmod(fd, 0644);
+
+				std::FILE* f = fdopen(fd, "wb");
+				if (f == nullptr) {
+					close(fd);
+					unlink(tmp_path.c_str());
+				}
+#endif
+				if (f == nullptr) throw std::runtime_error("Failed to create " + tmp_path);
+				return f;
+			}
+		}
+
+
+		// write `rows' to `path' with the token identifying the state of the data they were read from
+		// (see `load_result'); the file is written to a uniquely named file beside `path' and renamed over
+		// it, so that processes mapping `path' never see a partial file, even with several writers
+		inline void save_result(const std::string& path, const result_view& rows, const std::string& freshness = "") {
+			using namespace mapped_detail;
+
+			file_header h;
+			std::memset(&h, 0, sizeof(h));
+			std::memcpy(h.magic, magic, sizeof(h.magic));
+			h.format_version = format_version;
+			h.byte_order = byte_order_mark;
+			h.num_rows = rows.count();
+			h.num_fields = rows.fields();
+			h.freshness_length = (std::uint32_t)freshness.length();
+			h.data_size = rows.data_size();
+			h.created = (std::int64_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+			// offsets are rebuilt from the field lengths, so that any `result_view' can be saved
+			std::vector<std::uint64_t> offsets;
+			offsets.reserve(rows.count() * rows.fields() + 1);
+			std::uint64_t pos = 0;
+			for (std::size_t r = 0; r < rows.count(); r++) {
+				for (unsigned int i = 0; i < rows.fields(); i++) {
+					offsets.push_back(pos);
+					pos += rows.field_length(r, (int)i) + 1;
+				}
+			}
+			offsets.push_back(pos);
+
+			std::string tmp_path;
+			std::FILE* f = create_temp(path, tmp_path);
+
+			try {
+				static const char zeros[8] = {};
+				write(f, &h, sizeof(h), tmp_path);
+				write(f, freshness.data(), freshness.length(), tmp_path);
+				write(f, zeros, padded(freshness.length()) - freshness.length(), tmp_path);
+				write(f, offsets.data(), offsets.size() * sizeof(std::uint64_t), tmp_path);
+
+				for (std::size_t r = 0; r < rows.count(); r++) {
+					for (unsigned int i = 0; i < rows.fields(); i++) {
+						const char* field = rows.get_field_data(r, (int)i);
+						std::size_t len = rows.field_length(r, (int)i);
+						if (field != nullptr) write(f, field, len, tmp_path);
+						write(f, zeros, 1, tmp_path);
+					}
+				}
+
+				if (std::fclose(f) != 0) throw std::runtime_error("Failed to write " + tmp_path);
+
+#ifdef _WIN32
+				if (!MoveFileExA(tmp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+				if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+#endif
+					throw std::runtime_error("Failed to replace " + path);
+			}
+			catch (...) {
+				std::remove(tmp_path.c_str());
+				throw;
+			}
+		}
+
+		inline void save_result(const std::string& path, result& res, const std::string& freshness = "") {
+			save_result(path, cached_result(res), freshness);
+		}
+
+
+		// rows saved by `save_result', read in place from a memory-mapped file: opening costs a few
+		// system calls whatever the size, and pages are only read from disk when first accessed
+		class mapped_result : public result_view {
+		protected:
+			std::string token;
+			std::chrono::system_clock::time_point created;
+
+			void* base = nullptr;
+			std::size_t length = 0;
+#ifdef _WIN32
+			HANDLE file = INVALID_HANDLE_VALUE;
+			HANDLE mapping = nullptr;
+#endif
+
+			mapped_result() {}
+
+			bool map(const std::string& path) {
+#ifdef _WIN32
+				file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (file == INVALID_HANDLE_VALUE) return false;
+
+				LARGE_INTEGER size;
+				if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) return false;
+				length = (std::size_t)size.QuadPart;
+
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping == nullptr) return false;
+
+				base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				return base != nullptr;
+#else
+				int fd = ::open(path.c_str(), O_RDONLY);
+				if (fd < 0) return false;
+
+				struct stat st;
+				if (fstat(fd, &st) != 0 || st.st_size == 0) {
+					::close(fd);
+					return false;
+				}
+				length = (std::size_t)st.st_size;
+
+				// the mapping stays valid once the descriptor is closed
+				void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+				::close(fd);
+				if (p == MAP_FAILED) return false;
+
+				base = p;
+				return true;
+#endif
+			}
+
+			void unmap() {
+#ifdef _WIN32
+				if (base != nullptr) UnmapViewOfFile(base);
+				if (mapping != nullptr) CloseHandle(mapping);
+				if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+				mapping = nullptr;
+				file = INVALID_HANDLE_VALUE;
+#else
+				if (base != nullptr) munmap(base, length);
+#endif
+				base = nullptr;
+			}
+
+			// check the header and the section sizes against the file size, and the offset table against
+			// the data size, so that no field is read out of the mapping; the field data is not read
+			bool validate() {
+				using namespace mapped_detail;
+
+				if (length < sizeof(file_header)) return false;
+
+				file_header h;
+				std::memcpy(&h, base, sizeof(h));
+				if (std::memcmp(h.magic, magic, sizeof(h.magic)) != 0 || h.format_version != format_version || h.byte_order != byte_order_mark) return false;
+
+				// bounded by the file size first, so that the section sizes below cannot overflow
+				std::uint64_t max_offsets = length / sizeof(std::uint64_t);
+				if (h.data_size > length || (h.num_fields != 0 && h.num_rows > max_offsets / h.num_fields)) return false;
+
+				std::size_t token_end = sizeof(file_header) + padded(h.freshness_length);
+				std::size_t num_offsets = (std::size_t)(h.num_rows * h.num_fields + 1);
+				std::size_t data_start = token_end + num_offsets * sizeof(std::uint64_t);
+				if (length < token_end || length != data_start + h.data_size) return false;
+
+				const char* p = (const char*)base;
+				token.assign(p + sizeof(file_header), h.freshness_length);
+				created = std::chrono::system_clock::time_point(std::chrono::seconds(h.created));
+
+				num_rows = (std::size_t)h.num_rows;
+				num_fields = h.num_fields;
+				offsets = (const std::uint64_t*)(p + token_end);
+				data = p + data_start;
+
+				// every field is followed by its '\0', so offsets increase by at least 1
+				if (offsets[0] != 0 || offsets[num_offsets - 1] != h.data_size) return false;
+				for (std::size_t k = 1; k < num_offsets; k++)
+					if (offsets[k] <= offsets[k - 1]) return false;
+				return h.data_size == 0 || data[h.data_size - 1] == '\0';
+			}
+
+		public:
+			virtual ~mapped_result() {
+				unmap();
+			}
+
+			// map `path', nullptr if it is missing, truncated, corrupt or written in another format version or byte order
+			static std::shared_ptr<const mapped_result> open(const std::string& path) {
+				std::shared_ptr<mapped_result> res(new mapped_result());
+				if (!res->map(path) || !res->validate()) return nullptr;
+				return res;
+			}
+
+			// token given to `save_result'
+			const std::string& freshness() const {
+				return token;
+			}
+
+			std::chrono::system_clock::time_point created_at() const {
+				return created;
+			}
+		};
+
+
+		// first row of `freshness_query' as a token, its fields separated by '\x1f'
+		inline std::string freshness_token(connection& con, const std::string& freshness_query) {
+			result res = con.query(freshness_query);
+
+			std::string token;
+			if (res.is_empty()) return token;
+
+			for (unsigned int i = 0; i < res.fields(); i++) {
+				if (i > 0) token += '\x1f';
+				const char* field = res.get_field_data((int)i);
+				if (field != nullptr) token += field;
+			}
+			return token;
+		}
+
+		// rows of `query_str' through the file `path', for fast warm starts: the file is mapped if the
+		// token returned now by `freshness_query' (e.g. "select max(updated_at), count(*) from t" or
+		// "checksum table t") matches the one it was saved with; otherwise the query is run and the file
+		// rewritten. With an empty `freshness_query', an existing file is used as is
+		inline std::shared_ptr<const mapped_result> load_result(connection& con, const std::string& path, const std::string& query_str, const std::string& freshness_query = "") {
+			std::string token;
+			if (!freshness_query.empty()) token = freshness_token(con, freshness_query);
+
+			auto res = mapped_result::open(path);
+			if (res && (freshness_query.empty() || res->freshness() == token)) return res;
+			res.reset();
+
+			result rows = con.query(query_str);
+			save_result(path, rows, token);
+
+			res = mapped_result::open(path);
+			if (!res) throw std::runtime_error("Failed to map " + path);
+			return res;
+		}
+	}
+}
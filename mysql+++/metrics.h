@@ -0,0 +1,272 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+
+#include "observer.h"
+#include "lockfree.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		// monotonic counter split in cache-line-padded stripes: each thread increments its own stripe,
+		// so concurrent updates do not bounce a shared cache line between cores; reads sum the stripes
+		class metric_counter {
+		public:
+			static const unsigned int num_stripes = 16;
+
+		protected:
+			// padded rather than aligned, so that counters can be allocated with plain `new' before C++17
+			struct stripe {
+				std::atomic<unsigned long long> value{ 0 };
+				char padding[cache_line_size - sizeof(std::atomic<unsigned long long>)];
+			};
+
+			stripe stripes[num_stripes];
+
+			// threads get consecutive stripes, so up to `num_stripes' threads never share one
+			static unsigned int thread_stripe() {
+				static std::atomic<unsigned int> next_stripe{ 0 };
+				static thread_local unsigned int index = next_stripe++ % num_stripes;
+				return index;
+			}
+
+		public:
+			metric_counter() {}
+
+			metric_counter(const metric_counter&) = delete;
+			void operator =(const metric_counter&) = delete;
+
+			void add(unsigned long long n = 1) {
+				stripes[thread_stripe()].value.fetch_add(n, std::memory_order_relaxed);
+			}
+
+			unsigned long long value() const {
+				unsigned long long res = 0;
+				for (auto& s : stripes)
+					res += s.value.load(std::memory_order_relaxed);
+				return res;
+			}
+
+			void reset() {
+				for (auto& s : stripes)
+					s.value.store(0, std::memory_order_relaxed);
+			}
+		};
+
+
+		// value that goes up and down, e.g. connections currently in use
+		class metric_gauge {
+		protected:
+			char padding_before[cache_line_size];
+			std::atomic<long long> current{ 0 };
+			char padding_after[cache_line_size - sizeof(std::atomic<long long>)];
+
+		public:
+			metric_gauge() {}
+
+			metric_gauge(const metric_gauge&) = delete;
+			void operator =(const metric_gauge&) = delete;
+
+			void set(long long v) {
+				current.store(v, std::memory_order_relaxed);
+			}
+
+			void add(long long n = 1) {
+				current.fetch_add(n, std::memory_order_relaxed);
+			}
+
+			void sub(long long n = 1) {
+				current.fetch_sub(n, std::memory_order_relaxed);
+			}
+
+			long long value() const {
+				return current.load(std::memory_order_relaxed);
+			}
+		};
+
+
+		// metrics of the connections (and pools) it is attached to with `connection::set_metrics',
+		// rendered in the Prometheus text exposition format by `render'
+		//
+		// the built-in metrics are updated on the hot paths; other layers register their own
+		// counters and gauges by name, those are created once and then updated without locking
+		class metrics_registry {
+		public:
+			static const unsigned int num_statement_kinds = 4;		// query, exec, mquery, stmt_execute
+
+			metric_counter statements[num_statement_kinds];
+			metric_counter statement_nanoseconds[num_statement_kinds];
+			metric_counter rows_fetched;
+			metric_counter bytes_received;
+			metric_counter connects;
+			metric_counter connect_errors;
+			metric_counter reconnects;
+			metric_counter mutex_waits;					// connection mutex acquisitions that had to wait
+			metric_counter mutex_wait_nanoseconds;
+
+		protected:
+			struct family {
+				std::string help;
+				bool is_gauge;
+				std::map<std::string, std::unique_ptr<metric_counter>> counters;	// by label set
+				std::map<std::string, std::unique_ptr<metric_gauge>> gauges;
+			};
+
+			std::string prefix;
+
+			mutable std::mutex mutex;
+			std::map<unsigned int, unsigned long long> errors;		// by MySQL error code; errors are rare enough for a lock
+			std::map<std::string, family> families;
+
+			static const char* kind_label(unsigned int kind) {
+				static const char* names[num_statement_kinds] = { "query", "exec", "mquery", "stmt_execute" };
+				return names[kind];
+			}
+
+			static void header(std::string& res, const std::string& name, const char* help, const char* type) {
+				res += "# HELP " + name + " " + help + "\n";
+				res += "# TYPE " + name + " " + type + "\n";
+			}
+
+			static void sample(std::string& res, const std::string& name, const std::string& labels, double value) {
+				char buf[64];
+				std::snprintf(buf, sizeof(buf), " %.17g\n", value);
+
+				res += name;
+				if (!labels.empty()) res += "{" + labels + "}";
+				res += buf;
+			}
+
+		public:
+			metrics_registry(const metrics_registry&) = delete;
+			void operator =(const metrics_registry&) = delete;
+
+			// `_prefix' starts the name of every metric
+			metrics_registry(const std::string& _prefix = "mysqlpp_")
+				: prefix(_prefix)
+			{}
+
+			// account for a finished operation (called by the connection after the observer)
+			void record(const query_event& event) {
+				switch (event.kind) {
+				case query_event::query:
+				case query_event::exec:
+				case query_event::mquery:
+				case query_event::stmt_execute: {
+					unsigned int k = (unsigned int)event.kind;
+					statements[k].add();
+					statement_nanoseconds[k].add((unsigned long long)event.duration.count());
+					break;
+				}
+
+				case query_event::stmt_fetch:
+				case query_event::result_fetch:
+					rows_fetched.add(event.rows);
+					bytes_received.add(event.bytes);
+					break;
+				}
+
+				if (event.error != 0) record_error(event.error);
+			}
+
+			void record_error(unsigned int code) {
+				std::lock_guard<std::mutex> lg(mutex);
+				errors[code]++;
+			}
+
+			void record_mutex_wait(std::chrono::nanoseconds d) {
+				mutex_waits.add();
+				mutex_wait_nanoseconds.add((unsigned long long)d.count());
+			}
+
+			// named counter, created on first use; `labels' is a Prometheus label set such as `pool="main"'
+			metric_counter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+				std::lock_guard<std::mutex> lg(mutex);
+				family& f = families[name];
+				f.help = help;
+				f.is_gauge = false;
+
+				auto& c = f.counters[labels];
+				if (!c) c.reset(new metric_counter());
+				return *c;
+			}
+
+			// named gauge, created on first use
+			metric_gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "") {
+				std::lock_guard<std::mutex> lg(mutex);
+				family& f = families[name];
+				f.help = help;
+				f.is_gauge = true;
+
+				auto& g = f.gauges[labels];
+				if (!g) g.reset(new metric_gauge());
+				return *g;
+			}
+
+			unsigned long long error_count(unsigned int code) const {
+				std::lock_guard<std::mutex> lg(mutex);
+				auto itr = errors.find(code);
+				return itr == errors.end() ? 0 : itr->second;
+			}
+
+			// all metrics in the Prometheus text exposition format (version 0.0.4)
+			std::string render() const {
+				std::string res;
+
+				header(res, prefix + "statements_total", "Statements executed.", "counter");
+				for (unsigned int k = 0; k < num_statement_kinds; k++)
+					sample(res, prefix + "statements_total", std::string("kind=\"") + kind_label(k) + "\"", (double)statements[k].value());
+
+				header(res, prefix + "statement_seconds_total", "Time spent executing statements.", "counter");
+				for (unsigned int k = 0; k < num_statement_kinds; k++)
+					sample(res, prefix + "statement_seconds_total", std::string("kind=\"") + kind_label(k) + "\"", statement_nanoseconds[k].value() / 1e9);
+
+				header(res, prefix + "rows_fetched_total", "Rows received from the server.", "counter");
+				sample(res, prefix + "rows_fetched_total", "", (double)rows_fetched.value());
+
+				header(res, prefix + "bytes_received_total", "Bytes of field data received from the server.", "counter");
+				sample(res, prefix + "bytes_received_total", "", (double)bytes_received.value());
+
+				header(res, prefix + "connects_total", "Connections opened.", "counter");
+				sample(res, prefix + "connects_total", "", (double)connects.value());
+
+				header(res, prefix + "connect_errors_total", "Failed connection attempts.", "counter");
+				sample(res, prefix + "connect_errors_total", "", (double)connect_errors.value());
+
+				header(res, prefix + "reconnects_total", "Connections re-established after being lost.", "counter");
+				sample(res, prefix + "reconnects_total", "", (double)reconnects.value());
+
+				header(res, prefix + "mutex_waits_total", "Connection mutex acquisitions that had to wait.", "counter");
+				sample(res, prefix + "mutex_waits_total", "", (double)mutex_waits.value());
+
+				header(res, prefix + "mutex_wait_seconds_total", "Time spent waiting for connection mutexes.", "counter");
+				sample(res, prefix + "mutex_wait_seconds_total", "", mutex_wait_nanoseconds.value() / 1e9);
+
+				std::lock_guard<std::mutex> lg(mutex);
+
+				header(res, prefix + "errors_total", "Failed operations by MySQL error code.", "counter");
+				for (auto& e : errors)
+					sample(res, prefix + "errors_total", "code=\"" + std::to_string(e.first) + "\"", (double)e.second);
+
+				for (auto& f : families) {
+					header(res, prefix + f.first, f.second.help.c_str(), f.second.is_gauge ? "gauge" : "counter");
+					for (auto& c : f.second.counters)
+						sample(res, prefix + f.first, c.first, (double)c.second->value());
+					for (auto& g : f.second.gauges)
+						sample(res, prefix + f.first, g.first, (double)g.second->value());
+				}
+
+				return res;
+			}
+		};
+	}
+}
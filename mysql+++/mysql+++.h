@@ -17,6 +17,7 @@ Contributors: @Thalhammer, @sambrg, @amorphous1
 
 Macro Flags:
 	NO_STD_OPTIONAL	: using std::experimental::optional by polyfill instead of std::optional in C++17
+	NO_STD_PMR		: no std::pmr::memory_resource support for results, even when <memory_resource> is available
 
 */
 
@@ -32,17 +33,34 @@ Macro Flags:
 
 #include <mysql/mysql.h>
 #include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
 
 #include <string>
 #include <ctime>
 #include <mutex>
 #include <vector>
 #include <memory>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <cassert>
+#include <random>
+#include <map>
+#include <condition_variable>
+#include <cctype>
+#include <stdexcept>
 #include <stdarg.h>
 
 #include "polyfill/function_traits.h"
 #include "polyfill/datetime.h"
 
+#include "observer.h"
+#include "profiler.h"
+#include "metrics.h"
+#include "probes.h"
+#include "spill.h"
+#include "fields.h"
+
 
 #ifndef NO_STD_OPTIONAL
 #include <optional>
@@ -50,6 +68,14 @@ Macro Flags:
 #include "polyfill/optional.hpp"
 #endif
 
+// results allocating their rows from a std::pmr::memory_resource, with C++17
+#if !defined(NO_STD_PMR) && defined(__has_include)
+#if __has_include(<memory_resource>) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#define MYSQLPP_PMR
+#include <memory_resource>
+#endif
+#endif
+
 
 
 namespace daotk {
@@ -104,6 +130,10 @@ namespace daotk {
 				err_msg = mysql_error(conn);
 			}
 
+			mysql_exception(unsigned int number, const std::string& message)
+				: err_number(number), err_msg(message)
+			{}
+
 			virtual const char* what() const noexcept {
 				return err_msg.c_str();
 			}
@@ -121,7 +151,9 @@ namespace daotk {
 		public:
 			enum error_code {
 				result_already_fetched,
-				empty_result
+				empty_result,
+				query_timeout,
+				pool_exhausted
 			};
 
 		protected:
@@ -142,13 +174,270 @@ namespace daotk {
 			const std::string& error_message() const {
 				return err_msg;
 			}
+
+			error_code code() const {
+				return err;
+			}
 		};
 
 
+		// registers the current thread with the client library for its lifetime: every thread other than the
+		// one that initialized the library (mysql_library_init, or the first mysql_init) must do so before
+		// calling it, and release its per-thread state before exiting; used by every worker thread
+		class thread_init_guard {
+		public:
+			thread_init_guard(const thread_init_guard&) = delete;
+			void operator =(const thread_init_guard&) = delete;
+
+			thread_init_guard() {
+				mysql_thread_init();
+			}
+
+			~thread_init_guard() {
+				mysql_thread_end();
+			}
+		};
+
+
+
+
+		// run `fn(event)' and report it to `observer' and `metrics' with its duration and outcome, `fn' fills in rows and bytes
+		// and fire the matching USDT probes when compiled with MYSQLPP_USDT
+		// (without an observer, metrics or probes this costs a single branch: nothing is timed, reported or allocated)
+		template <typename Function>
+		void observe(query_observer* observer, metrics_registry* metrics, query_event::kind_type kind, const char* sql, std::size_t sql_length, const void* stmt, Function fn) {
+			query_event event{ kind, sql, sql_length, stmt, std::chrono::nanoseconds(0), 0, 0, 0 };
+			bool probing = probes_enabled();
+			if (observer == nullptr && metrics == nullptr && !probing) {
+				fn(event);
+				return;
+			}
+
+			auto finish = [&](std::chrono::steady_clock::time_point start) {
+				event.duration = std::chrono::steady_clock::now() - start;
+				if (observer != nullptr) observer->on_end(event);
+				if (metrics != nullptr) metrics->record(event);
+				if (probing) probe_end(event);
+			};
+
+			if (probing) probe_start(event);
+			if (observer != nullptr) observer->on_start(event);
+			auto start = std::chrono::steady_clock::now();
+
+			try {
+				fn(event);
+			}
+			catch (mysql_exception& exp) {
+				event.error = exp.error_number();
+				finish(start);
+				throw;
+			}
+			catch (mysqlpp_exception& exp) {
+				event.error = (exp.code() == mysqlpp_exception::query_timeout) ? ER_QUERY_TIMEOUT : CR_UNKNOWN_ERROR;
+				finish(start);
+				throw;
+			}
+			catch (...) {
+				if (event.error == 0) event.error = CR_UNKNOWN_ERROR;
+				finish(start);
+				throw;
+			}
+
+			finish(start);
+		}
+
+
+
+		// conversions from textual field data (nullptr meaning NULL) to C++ values
+
+		inline bool parse_field(const char* s, bool& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = (std::stoi(s) != 0);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, int& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stoi(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, unsigned int& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = (unsigned int)std::stoul(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, long& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stol(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, unsigned long& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stoul(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, long long& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stoll(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, unsigned long long& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stoull(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, float& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stof(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, double& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stod(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, long double& value) {
+			if (s == nullptr) return false;
+
+			try {
+				value = std::stold(s);
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+		}
+
+		inline bool parse_field(const char* s, std::string& value) {
+			if (s == nullptr) return false;
+
+			value = s;
+			return true;
+		}
+
+		inline bool parse_field(const char* s, datetime& value) {
+			if (s == nullptr) return false;
+
+			value.from_sql(s);
+			return true;
+		}
+
+		template <typename Value>
+		bool parse_field(const char* s, optional<Value>& value) {
+			Value v;
+			if (parse_field(s, v)) value = v;
+			else value.reset();
+			return true;
+		}
+
+		// the same, for fields of known length: strings may then hold '\0's
+		template <typename Value>
+		bool parse_field(const char* s, std::size_t len, Value& value) {
+			(void)len;
+			return parse_field(s, value);
+		}
+
+		inline bool parse_field(const char* s, std::size_t len, std::string& value) {
+			if (s == nullptr) return false;
+
+			value.assign(s, len);
+			return true;
+		}
+
+		template <typename Value>
+		bool parse_field(const char* s, std::size_t len, optional<Value>& value) {
+			Value v;
+			if (parse_field(s, len, v)) value = std::move(v);
+			else value.reset();
+			return true;
+		}
+
+		// decode a row into the fields of `s' (see MYSQLPP_FIELDS), `columns' as given by `match_columns';
+		// `field_of(c, len)' returns column `c' and its length, nullptr for NULL. Fields that are NULL or
+		// cannot be parsed are reset to their default value, fields without a column are left untouched
+		template <typename Struct, typename FieldOf>
+		void decode_struct(Struct& s, const std::vector<int>& columns, FieldOf field_of) {
+			for_each_field<Struct>([&](const auto& field, std::size_t k) {
+				if (columns[k] < 0) return;
+
+				auto& value = s.*(field.member);
+				std::size_t len = 0;
+				const char* data = field_of((unsigned int)columns[k], len);
+				if (!parse_field(data, len, value)) value = typename std::decay<decltype(value)>::type();
+			});
+		}
+
 
 
 		class result;
 		class connection;
+		class result_view;
+		class cached_result;
+
+		template <typename... Values>
+		class prefetch_reader;
 
 
 		// iterator class that can be used for iterating returned result rows
@@ -307,27 +596,119 @@ namespace daotk {
 		class result {
 
 			friend class connection;
+			friend class result_view;
+			friend class cached_result;
 
 		protected:
 			MYSQL* my_conn = nullptr;
 			bool fetched = false;
+			query_observer* observer = nullptr;
+			metrics_registry* metrics = nullptr;
 
-			// used only when `mode == mode_fetch'
-			std::vector< std::vector<std::string> > rows;
-			std::vector< std::vector<std::string> >::iterator current_row_itr;
-			unsigned int num_fields;
+			// set when profiling: conversion time is accumulated and recorded when the result is freed
+			statement_profile* profile = nullptr;
+			std::chrono::nanoseconds convert_time{ 0 };
+
+#ifdef MYSQLPP_PMR
+			using row_type = std::pmr::vector<std::pmr::string>;
+			using rows_type = std::pmr::vector<row_type>;
+			using resource_type = std::pmr::memory_resource*;
+#else
+			using row_type = std::vector<std::string>;
+			using rows_type = std::vector<row_type>;
+			using resource_type = std::nullptr_t;
+#endif
+
+			// used only when `mode == mode_fetch'; only the first `num_rows' are rows of this result, those
+			// after them are storage kept from previous queries (see `connection::query_into')
+			rows_type rows;
+			std::size_t num_rows = 0;
+			std::size_t current_row = 0;
+			unsigned int num_fields = 0;
+			std::vector<std::string> field_names;		// empty for results not read from the server (`result_view::to_result')
+
+			// columns of the fields of the last struct type decoded (see `fetch_struct')
+			const void* mapped_struct = nullptr;
+			std::vector<int> mapped_columns;
+
+			// rows beyond `spill_opts->memory_limit' are stored in `spill', after those of `rows'
+			std::shared_ptr<const spill_options> spill_opts;
+			std::unique_ptr<spill_file> spill;
 
 
-			result(MYSQL* _my_conn, bool fetch_now = false)
-				: my_conn(_my_conn)
+			result(MYSQL* _my_conn, bool fetch_now = false, query_observer* _observer = nullptr, statement_profile* _profile = nullptr, metrics_registry* _metrics = nullptr, std::shared_ptr<const spill_options> _spill_opts = nullptr, resource_type resource = nullptr)
+				: my_conn(_my_conn), observer(_observer), metrics(_metrics), profile(_profile), rows(make_rows(resource)), spill_opts(std::move(_spill_opts))
 			{
 				if (fetch_now) fetch();
 			}
 
+			// rows allocated from `resource', the default one if nullptr
+			static rows_type make_rows(resource_type resource) {
+#ifdef MYSQLPP_PMR
+				return rows_type(resource != nullptr ? resource : std::pmr::get_default_resource());
+#else
+				(void)resource;
+				return rows_type();
+#endif
+			}
+
+			// field `i' of row `row', whether in memory or spilled, and its length
+			const char* field(std::size_t row, unsigned int i, std::size_t& len) const {
+				if (row < num_rows) {
+					len = rows[row][i].length();
+					return rows[row][i].c_str();
+				}
+				return spill->field(row - num_rows, i, len);
+			}
+
+			std::size_t count_rows() const {
+				return num_rows + (spill ? spill->count() : 0);
+			}
+
 			void check_condition() {
 				if (!fetched) fetch();
 			}
 
+			// `keep_rows' keeps the storage of the rows, for `connection::query_into' to overwrite it
+			void free(bool keep_rows) {
+				if (!fetched) {
+					if (my_conn != nullptr) {
+						// mysql_use_result must be called for SELECT, SHOW,...
+						// https://dev.mysql.com/doc/refman/8.0/en/mysql-use-result.html
+						MYSQL_RES* _res = mysql_use_result(my_conn);
+						if (_res != nullptr) mysql_free_result(_res);
+					}
+				}
+				else {
+					if (!keep_rows) rows.clear();
+					spill.reset();
+				}
+				num_rows = 0;
+				current_row = 0;
+				mapped_struct = nullptr;
+
+				if (profile != nullptr && convert_time.count() > 0) {
+					profile->record(query_phase::convert, convert_time);
+					convert_time = std::chrono::nanoseconds(0);
+				}
+
+				my_conn = nullptr;
+				fetched = false;
+			}
+
+			// make this the result of the last query run on `_my_conn', keeping the storage of the rows
+			void attach(MYSQL* _my_conn, bool fetch_now, query_observer* _observer, statement_profile* _profile, metrics_registry* _metrics, std::shared_ptr<const spill_options> _spill_opts) {
+				free(true);
+
+				my_conn = _my_conn;
+				observer = _observer;
+				profile = _profile;
+				metrics = _metrics;
+				spill_opts = std::move(_spill_opts);
+
+				if (fetch_now) fetch();
+			}
+
 
 
 			template <typename Function, std::size_t Index>
@@ -355,28 +736,72 @@ namespace daotk {
 			result() {
 			}
 
-			result(result&& r) noexcept {
+#ifdef MYSQLPP_PMR
+			// empty result whose rows will be allocated from `resource', which must outlive it
+			explicit result(std::pmr::memory_resource* resource)
+				: rows(make_rows(resource))
+			{}
+
+			std::pmr::memory_resource* get_memory_resource() const {
+				return rows.get_allocator().resource();
+			}
+#endif
+
+			result(result&& r) noexcept
+				: rows(std::move(r.rows))
+			{
 				my_conn = r.my_conn;
 				fetched = r.fetched;
-
-				rows = std::move(r.rows);
-				current_row_itr = r.current_row_itr;
+				observer = r.observer;
+				metrics = r.metrics;
+				profile = r.profile;
+				convert_time = r.convert_time;
+
+				num_rows = r.num_rows;
+				current_row = r.current_row;
+				num_fields = r.num_fields;
+				field_names = std::move(r.field_names);
+				mapped_struct = r.mapped_struct;
+				mapped_columns = std::move(r.mapped_columns);
+				spill_opts = std::move(r.spill_opts);
+				spill = std::move(r.spill);
 
 				r.my_conn = nullptr;
 				r.fetched = false;
+				r.profile = nullptr;
+				r.num_rows = 0;
 			}
 
 			void operator =(result&& r) noexcept {
+				// `rows' is destroyed and rebuilt in place below, which would lose the rows of a self-move
+				if (this == &r) return;
+
 				free();
 
 				my_conn = r.my_conn;
 				fetched = r.fetched;
-
-				rows = std::move(r.rows);
-				current_row_itr = r.current_row_itr;
+				observer = r.observer;
+				metrics = r.metrics;
+				profile = r.profile;
+				convert_time = r.convert_time;
+
+				// the rows come with their memory resource: a move assignment of containers whose
+				// allocators differ would copy every field into the resource of this result
+				rows.~rows_type();
+				new (&rows) rows_type(std::move(r.rows));
+				num_rows = r.num_rows;
+				current_row = r.current_row;
+				num_fields = r.num_fields;
+				field_names = std::move(r.field_names);
+				mapped_struct = r.mapped_struct;
+				mapped_columns = std::move(r.mapped_columns);
+				spill_opts = std::move(r.spill_opts);
+				spill = std::move(r.spill);
 
 				r.my_conn = nullptr;
 				r.fetched = false;
+				r.profile = nullptr;
+				r.num_rows = 0;
 			}
 
 			virtual ~result() {
@@ -384,43 +809,88 @@ namespace daotk {
 			}
 
 			void free() {
-				if (!fetched) {
-					if (my_conn != nullptr) {
-						// mysql_use_result must be called for SELECT, SHOW,...
-						// https://dev.mysql.com/doc/refman/8.0/en/mysql-use-result.html
-						MYSQL_RES* _res = mysql_use_result(my_conn);
-						if (_res != nullptr) mysql_free_result(_res);
-					}
-				}
-				else {
-					rows.clear();
-				}
-
-				my_conn = nullptr;
-				fetched = false;
+				free(false);
 			}
 
 			// store result internally for further queries to avoid Error #2014 (Commands out of sync)
 			void fetch() {
 				if (fetched) throw mysqlpp_exception(mysqlpp_exception::result_already_fetched);
-				MYSQL_RES* _res = mysql_store_result(my_conn);
-
-				num_fields = mysql_num_fields(_res);
-				if (num_fields > 0) {
-					while (MYSQL_ROW _row = mysql_fetch_row(_res)) {
-						auto fetch_lengths = mysql_fetch_lengths(_res);
-						if (fetch_lengths == nullptr) throw mysql_exception{ my_conn };
-
-						std::vector<std::string> rowdata;
-						for (unsigned int i = 0; i < num_fields; i++)
-							rowdata.push_back(std::string(_row[i], fetch_lengths[i]));
-						rows.push_back(rowdata);
+
+				observe(observer, metrics, query_event::result_fetch, nullptr, 0, nullptr, [&](query_event& event) {
+					// with a memory budget the rows are streamed, so that the client library does not buffer them all first
+					std::size_t memory_limit = spill_opts ? spill_opts->memory_limit : 0;
+
+					auto t0 = profile ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+					MYSQL_RES* _res = memory_limit > 0 ? mysql_use_result(my_conn) : mysql_store_result(my_conn);
+					auto t1 = profile ? std::chrono::steady_clock::now() : t0;
+
+					if (_res == nullptr) {
+						// no result set (INSERT, UPDATE...) unless storing it failed
+						if (mysql_field_count(my_conn) != 0) throw mysql_exception{ my_conn };
+						num_fields = 0;
+						current_row = 0;
+						return;
 					}
 
-					current_row_itr = rows.begin();
-				}
+					num_fields = mysql_num_fields(_res);
+					std::size_t memory_used = 0;
+
+					MYSQL_FIELD* _fields = mysql_fetch_fields(_res);
+					field_names.resize(num_fields);
+					for (unsigned int i = 0; i < num_fields; i++)
+						field_names[i].assign(_fields[i].name, _fields[i].name_length);
+
+					try {
+						if (num_fields > 0) {
+							while (MYSQL_ROW _row = mysql_fetch_row(_res)) {
+								auto fetch_lengths = mysql_fetch_lengths(_res);
+								if (fetch_lengths == nullptr) throw mysql_exception{ my_conn };
+
+								std::size_t row_bytes = 0;
+								for (unsigned int i = 0; i < num_fields; i++)
+									row_bytes += fetch_lengths[i];
+								event.bytes += row_bytes;
+
+								// beyond the memory budget, rows go to a spill file
+								if (memory_limit > 0 && (spill || memory_used + row_bytes > memory_limit)) {
+									if (!spill) spill.reset(new spill_file(num_fields, spill_opts->directory));
+									spill->append(_row, fetch_lengths);
+								}
+								else {
+									// overwrite a row kept from a previous query, reusing the capacity of its fields
+									if (num_rows == rows.size()) rows.emplace_back();
+									row_type& rowdata = rows[num_rows++];
+
+									rowdata.resize(num_fields);
+									for (unsigned int i = 0; i < num_fields; i++)
+										rowdata[i].assign(_row[i], fetch_lengths[i]);
+									memory_used += row_bytes + sizeof(row_type) + num_fields * sizeof(row_type::value_type);
+								}
+								MYSQLPP_PROBE1(row__fetched, num_fields);
+							}
+
+							// a streamed result ends the same way on an error as on its last row
+							if (memory_limit > 0 && mysql_errno(my_conn) != 0) throw mysql_exception{ my_conn };
+							if (spill) spill->seal();
+						}
+					}
+					catch (...) {
+						mysql_free_result(_res);
+						num_rows = 0;
+						spill.reset();
+						throw;
+					}
+
+					current_row = 0;
+					mysql_free_result(_res);
 
-				mysql_free_result(_res);
+					if (profile != nullptr) {
+						profile->record(query_phase::transfer, t1 - t0);
+						profile->record(query_phase::decode, std::chrono::steady_clock::now() - t1);
+					}
+
+					event.rows = count_rows();
+				});
 
 				fetched = true;
 			}
@@ -429,7 +899,14 @@ namespace daotk {
 			std::size_t count() {
 				check_condition();
 
-				return rows.size();
+				return count_rows();
+			}
+
+			// number of rows stored in a spill file, see `spill_options'
+			std::size_t spilled() {
+				check_condition();
+
+				return spill ? spill->count() : 0;
 			}
 
 			// return number of fields
@@ -439,6 +916,14 @@ namespace daotk {
 				return num_fields;
 			}
 
+			// name (or alias) of field `i', empty if unknown
+			std::string field_name(int i) {
+				check_condition();
+
+				if (i < 0 || (unsigned int)i >= num_fields) throw std::out_of_range("Invalid field index");
+				return (unsigned int)i < field_names.size() ? field_names[i] : std::string();
+			}
+
 			// return true if no data was returned
 			bool is_empty() {
 				return count() == 0;
@@ -448,7 +933,7 @@ namespace daotk {
 			bool eof() {
 				check_condition();
 
-				return current_row_itr == rows.end();
+				return current_row >= count_rows();
 			}
 
 			// go to first row
@@ -460,28 +945,28 @@ namespace daotk {
 			void seek(std::size_t n) {
 				check_condition();
 
-				current_row_itr = rows.begin() + n;
+				current_row = n;
 			}
 
 			// go to next row
 			void next() {
 				check_condition();
 
-				current_row_itr++;
+				current_row++;
 			}
 
 			// go to previous row
 			void prev() {
 				check_condition();
 
-				current_row_itr--;
+				current_row--;
 			}
 
 			// return curent row index
 			std::size_t tell() {
 				check_condition();
 
-				return current_row_itr - rows.begin();
+				return current_row;
 			}
 
 			// iterate through all rows, each time execute the callback function
@@ -510,157 +995,75 @@ namespace daotk {
 
 			// get-value functions in different ways and types...
 
+		protected:
+			template <typename Value>
+			bool convert(int i, Value& value) {
+				if (profile == nullptr) return parse_field(get_field_data(i), value);
+
+				auto t0 = std::chrono::steady_clock::now();
+				bool res = parse_field(get_field_data(i), value);
+				convert_time += std::chrono::steady_clock::now() - t0;
+				return res;
+			}
+
+		public:
+
 			const char* get_field_data(int i) {
 				check_condition();
 
-				if (current_row_itr == rows.end() || (*current_row_itr)[i].empty()) return nullptr;
-				return (*current_row_itr)[i].c_str();
+				if (current_row >= count_rows()) return nullptr;
+
+				std::size_t len;
+				const char* data = field(current_row, (unsigned int)i, len);
+				return len > 0 ? data : nullptr;
 			}
 
 			bool get_value(int i, bool& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = (std::stoi(s) != 0);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, int& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stoi(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, unsigned int& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = (unsigned int)std::stoul(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, long& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stol(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, unsigned long& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stoul(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, long long& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stoll(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, unsigned long long& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stoull(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, float& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stof(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, double& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stod(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, long double& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				try {
-					value = std::stold(s);
-					return true;
-				}
-				catch (std::exception&) {
-					return false;
-				}
+				return convert(i, value);
 			}
 
 			bool get_value(int i, std::string& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				value = s;
-				return true;
+				return convert(i, value);
 			}
 
 			bool get_value(int i, datetime& value) {
-				const char* s = get_field_data(i);
-				if (s == nullptr) return false;
-
-				value.from_sql(s);
-				return true;
+				return convert(i, value);
 			}
 
 			template <typename Value>
@@ -713,11 +1116,121 @@ namespace daotk {
 			bool fetch(Values&... values) {
 				check_condition();
 
-				if (current_row_itr == rows.end()) return false;
+				if (current_row >= count_rows()) return false;
 
 				fetch_impl(0, std::forward<Values&>(values)...);
 				return true;
 			}
+
+		protected:
+			// columns of the fields of `Struct', matched by name once per result; by position when
+			// the names are unknown
+			template <typename Struct>
+			const std::vector<int>& columns_of() {
+				if (mapped_struct == fields_detail::type_key<Struct>()) return mapped_columns;
+
+				if (field_names.size() == num_fields)
+					match_columns<Struct>(num_fields, [this](unsigned int c) { return field_names[c].c_str(); }, mapped_columns);
+				else {
+					mapped_columns.assign(field_count<Struct>(), -1);
+					for (std::size_t k = 0; k < mapped_columns.size() && k < num_fields; k++)
+						mapped_columns[k] = (int)k;
+				}
+
+				mapped_struct = fields_detail::type_key<Struct>();
+				return mapped_columns;
+			}
+
+			template <typename Struct>
+			void decode_row(std::size_t row, Struct& s, const std::vector<int>& columns) {
+				decode_struct(s, columns, [&](unsigned int c, std::size_t& len) {
+					const char* data = field(row, c, len);
+					return len > 0 ? data : nullptr;
+				});
+			}
+
+		public:
+			// get data from the current row into the fields of `s', declared with MYSQLPP_FIELDS
+			template <typename Struct>
+			bool fetch_struct(Struct& s) {
+				static_assert(has_fields<Struct>::value, "Struct must declare its fields with MYSQLPP_FIELDS");
+				check_condition();
+
+				if (current_row >= count_rows()) return false;
+
+				auto t0 = profile ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+				decode_row(current_row, s, columns_of<Struct>());
+				if (profile != nullptr) convert_time += std::chrono::steady_clock::now() - t0;
+				return true;
+			}
+
+			// get all rows into `structs', reusing its elements; return the number of rows
+			template <typename Struct>
+			std::size_t fetch_all(std::vector<Struct>& structs) {
+				static_assert(has_fields<Struct>::value, "Struct must declare its fields with MYSQLPP_FIELDS");
+				check_condition();
+
+				std::size_t n = count_rows();
+				structs.resize(n);
+
+				auto t0 = profile ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+				const std::vector<int>& columns = columns_of<Struct>();
+				for (std::size_t r = 0; r < n; r++)
+					decode_row(r, structs[r], columns);
+				if (profile != nullptr) convert_time += std::chrono::steady_clock::now() - t0;
+				return n;
+			}
+
+			template <typename Struct>
+			std::vector<Struct> fetch_all() {
+				std::vector<Struct> structs;
+				fetch_all(structs);
+				return structs;
+			}
+		};
+
+
+		// how failed statements are retried: exponential backoff with random jitter between attempts
+		//
+		// statements are only retried automatically when they were not part of an open transaction
+		// (a lost connection or a deadlock ends the whole transaction); use `connection::with_retry'
+		// to retry a complete transaction. Note that a statement whose connection was lost while it
+		// was running (CR_SERVER_LOST) may already have been applied by the server.
+		struct retry_policy {
+			unsigned int max_attempts = 1;						// total attempts, 1 means no retry
+			std::chrono::milliseconds initial_backoff{ 20 };
+			std::chrono::milliseconds max_backoff{ 2000 };
+			double multiplier = 2.0;
+			double jitter = 0.5;								// fraction of each delay that is randomized
+
+			// error classification, defaults to `is_transient_error'
+			std::function<bool(unsigned int)> retryable;
+
+			static bool is_connection_error(unsigned int err_code) {
+				return err_code == CR_SERVER_GONE_ERROR || err_code == CR_SERVER_LOST;
+			}
+
+			static bool is_transient_error(unsigned int err_code) {
+				return is_connection_error(err_code) || err_code == ER_LOCK_DEADLOCK || err_code == ER_LOCK_WAIT_TIMEOUT;
+			}
+
+			// true if another attempt may follow the failed attempt number `attempt' (1-based)
+			bool should_retry(unsigned int err_code, unsigned int attempt) const {
+				if (attempt >= max_attempts) return false;
+				return retryable ? retryable(err_code) : is_transient_error(err_code);
+			}
+
+			// delay to wait after the failed attempt number `attempt'
+			std::chrono::milliseconds backoff(unsigned int attempt) const {
+				double delay = (double)initial_backoff.count();
+				for (unsigned int i = 1; i < attempt && delay < max_backoff.count(); i++)
+					delay *= multiplier;
+				if (delay > max_backoff.count()) delay = (double)max_backoff.count();
+
+				static thread_local std::mt19937 rng{ std::random_device{}() };
+				std::uniform_real_distribution<double> dist(1.0 - jitter, 1.0);
+				return std::chrono::milliseconds((long long)(delay * dist(rng)));
+			}
 		};
 
 
@@ -761,6 +1274,40 @@ namespace daotk {
 			unsigned long client_flag;
 			bool ssl_enforce;
 			bool ssl_verify_server_cert;
+			retry_policy retry;
+			unsigned int read_timeout = 0;		// seconds, network read timeout of every server reply
+			unsigned int write_timeout = 0;		// seconds, network write timeout of every request
+			std::vector<std::string> init_commands;		// run on connection after `init_command', one statement each
+		};
+
+
+		// per-call deadline for `connection::query' and `connection::exec'
+		struct deadline {
+			std::chrono::milliseconds timeout;
+			bool execution_time_hint;			// add a MAX_EXECUTION_TIME optimizer hint to SELECT statements
+
+			deadline(std::chrono::milliseconds _timeout, bool _execution_time_hint = true)
+				: timeout(_timeout), execution_time_hint(_execution_time_hint)
+			{}
+		};
+
+
+		class query_canceller;
+
+
+		enum class threading_mode {
+			shared,			// any thread may use the connection, statements are serialized by its mutex
+			single_owner	// one thread owns the connection and the mutex is skipped on the hot path;
+							// use from another thread is checked by assertions in debug builds
+		};
+
+
+		// time spent acquiring a connection's mutex, see `connection::lock_stats'
+		struct lock_statistics {
+			unsigned long long acquisitions;
+			unsigned long long contended;		// acquisitions that had to wait for another thread
+			std::chrono::nanoseconds wait_time;
+			std::chrono::nanoseconds max_wait;
 		};
 
 
@@ -769,40 +1316,249 @@ namespace daotk {
 
 			friend class prepared_stmt;
 
+			template <typename... Values>
+			friend class prefetch_reader;
+
 		protected:
 			MYSQL* my_conn;
 			mutable std::mutex mutex;	// mutex needs to be locked while using a prepared stmt
 
-		public:
-			// open a connection (close the old one if already open), return true if successful
-			bool open(const connect_options& options) {
-				if (is_open()) close();
-
-				std::lock_guard<std::mutex> mg(mutex);
-
-				my_conn = mysql_init(nullptr);
-				if (my_conn == nullptr) return false;
+			connect_options options;
+			unsigned int connect_err_number = 0;	// error of the last failed open(), when there is no handle to ask
+			std::string connect_err_msg;
+			unsigned long thread_id = 0;
+			unsigned long long generation = 0;	// incremented on every (re)connection, so that prepared statements know to re-prepare
+			std::string schema;						// current database: `options.dbname', then as changed by USE
+			mutable std::mutex schema_mutex;
+
+			std::shared_ptr<query_canceller> canceller;
+			query_observer* observer = nullptr;
+			std::atomic<query_profiler*> profiler{ nullptr };
+			std::atomic<metrics_registry*> metrics{ nullptr };
+			std::shared_ptr<const spill_options> spill_opts;
+
+			threading_mode mode = threading_mode::shared;
+			std::thread::id owner;					// in single-owner mode
+			std::atomic<unsigned long long> lock_acquisitions{ 0 };
+			std::atomic<unsigned long long> lock_contentions{ 0 };
+			std::atomic<long long> lock_wait_ns{ 0 };
+			std::atomic<long long> lock_max_wait_ns{ 0 };
+
+
+			// create a new connected handle, nullptr if failed
+			MYSQL* connect_handle(const connect_options& options) {
+				MYSQL* conn = mysql_init(nullptr);
+				if (conn == nullptr) {
+					connect_err_number = CR_OUT_OF_MEMORY;
+					connect_err_msg = "Out of memory";
+					return nullptr;
+				}
 
 				if (options.autoreconnect) {
 					bool b = options.autoreconnect;
-					mysql_options(my_conn, MYSQL_OPT_RECONNECT, &b);
+					mysql_options(conn, MYSQL_OPT_RECONNECT, &b);
 				}
-				if (!options.charset.empty()) mysql_options(my_conn, MYSQL_SET_CHARSET_NAME, options.charset.c_str());
-				if (!options.init_command.empty()) mysql_options(my_conn, MYSQL_INIT_COMMAND, options.init_command.c_str());
-				if (options.timeout > 0) mysql_options(my_conn, MYSQL_OPT_CONNECT_TIMEOUT, (char*)&options.timeout);
+				if (!options.charset.empty()) mysql_options(conn, MYSQL_SET_CHARSET_NAME, options.charset.c_str());
+				if (!options.init_command.empty()) mysql_options(conn, MYSQL_INIT_COMMAND, options.init_command.c_str());
+				for (auto& cmd : options.init_commands)
+					mysql_options(conn, MYSQL_INIT_COMMAND, cmd.c_str());
+				if (options.timeout > 0) mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, (char*)&options.timeout);
+				if (options.read_timeout > 0) mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, (char*)&options.read_timeout);
+				if (options.write_timeout > 0) mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, (char*)&options.write_timeout);
 
 				bool ssl_enforce = options.ssl_enforce;
-				mysql_options(my_conn, MYSQL_OPT_SSL_ENFORCE, &ssl_enforce);
+				mysql_options(conn, MYSQL_OPT_SSL_ENFORCE, &ssl_enforce);
+
+				bool ssl_verify = options.ssl_verify_server_cert;
+				mysql_options(conn, MYSQL_OPT_SSL_VERIFY_SERVER_CERT, &ssl_verify);
+
+				metrics_registry* m = metrics.load(std::memory_order_relaxed);
+				if (nullptr == mysql_real_connect(conn, options.server.c_str(), options.username.c_str(), options.password.c_str(), options.dbname.c_str(), options.port, NULL, options.client_flag)) {
+					connect_err_number = mysql_errno(conn);
+					connect_err_msg = mysql_error(conn);
+					mysql_close(conn);
+					if (m != nullptr) m->connect_errors.add();
+					return nullptr;
+				}
+
+				if (m != nullptr) m->connects.add();
+				connect_err_number = 0;
+				connect_err_msg.clear();
+				return conn;
+			}
+
+			void set_schema(const std::string& db) {
+				std::lock_guard<std::mutex> lg(schema_mutex);
+				schema = db;
+			}
+
+			// follow USE statements, which the server reports when session_track_schema is on (the default)
+			void track_schema() {
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 50704
+				const char* data = nullptr;
+				size_t len = 0;
+				if (mysql_session_track_get_first(my_conn, SESSION_TRACK_SCHEMA, &data, &len) == 0 && data != nullptr)
+					set_schema(std::string(data, len));
+#endif
+			}
+
+			// detect a reconnection done silently by the client library (MYSQL_OPT_RECONNECT)
+			void check_reconnected() {
+				unsigned long id = mysql_thread_id(my_conn);
+				if (id != thread_id) {
+					metrics_registry* m = metrics.load(std::memory_order_relaxed);
+					if (m != nullptr && thread_id != 0) m->reconnects.add();
+
+					thread_id = id;
+					generation++;
+				}
+			}
+
+			// lock the connection for a statement; a contended acquisition is timed and accounted in the lock
+			// statistics (and the metrics, if attached); in single-owner mode nothing is locked
+			std::unique_lock<std::mutex> lock() {
+				if (mode == threading_mode::single_owner) {
+					assert(owner == std::this_thread::get_id() && "single-owner connection used from another thread");
+					return std::unique_lock<std::mutex>();
+				}
+
+				std::unique_lock<std::mutex> lk(mutex, std::try_to_lock);
+				lock_acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+				if (!lk.owns_lock()) {
+					auto t0 = std::chrono::steady_clock::now();
+					lk.lock();
+					auto d = std::chrono::steady_clock::now() - t0;
+
+					long long ns = (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+					lock_contentions.fetch_add(1, std::memory_order_relaxed);
+					lock_wait_ns.fetch_add(ns, std::memory_order_relaxed);
+					if (ns > lock_max_wait_ns.load(std::memory_order_relaxed)) lock_max_wait_ns.store(ns, std::memory_order_relaxed);	// updated under the mutex
+
+					metrics_registry* m = metrics.load(std::memory_order_relaxed);
+					if (m != nullptr) m->record_mutex_wait(d);
+				}
+				return lk;
+			}
+
+			// run `fn()', a C API call standing for the statement `sql' (COMMIT...) that returns nonzero on
+			// failure, locked and observed like the statements sent as text
+			template <typename Function>
+			void control(const char* sql, Function fn) {
+				auto lk = lock();
+				if (my_conn == nullptr) throw mysql_exception(CR_SERVER_GONE_ERROR, "Not connected");
+
+				observe(observer, metrics.load(std::memory_order_relaxed), query_event::exec, sql, std::char_traits<char>::length(sql), nullptr, [&](query_event&) {
+					if (fn()) throw mysql_exception{ my_conn };
+				});
+			}
+
+			// statements returning rows are fetched while the connection is still locked, unless a single thread
+			// owns it: another thread could otherwise send a statement before the rows are read (Commands out of sync)
+			bool fetch_eagerly() const {
+				return mode == threading_mode::shared;
+			}
+
+			// called with the mutex held after a connection-lost error: reconnect if `autoreconnect' is set
+			bool recover() {
+				if (!options.autoreconnect) return false;
+
+				if (mysql_ping(my_conn) == 0) {
+					check_reconnected();
+					return true;
+				}
+
+				MYSQL* conn = connect_handle(options);
+				if (conn == nullptr) return false;
+
+				mysql_close(my_conn);
+				my_conn = conn;
+				set_schema(options.dbname);
+				check_reconnected();
+				return true;
+			}
+
+			// sleep before the next attempt without holding the connection
+			void wait_before_retry(std::unique_lock<std::mutex>& lk, unsigned int attempt) {
+				auto delay = options.retry.backoff(attempt);
+				bool locked = lk.owns_lock();		// not locked in single-owner mode
+
+				if (locked) lk.unlock();
+				std::this_thread::sleep_for(delay);
+				if (locked) lk.lock();
+			}
+
+			// run `fn(sql)', which sends the statement and reads its result, under a deadline;
+			// called with the mutex held
+			template <typename Function>
+			void run_with_deadline(const deadline& dl, const std::string& query_str, Function fn);
+
+			// profile of a statement when profiling, nullptr otherwise
+			statement_profile* profile_of(const std::string& query_str) {
+				query_profiler* prof = profiler.load(std::memory_order_relaxed);
+				return prof ? &prof->profile(query_str) : nullptr;
+			}
+
+			// format a printf-style statement, timing it when profiling
+			template <typename... Values>
+			std::string format_query(const std::string& fmt_str, Values... values) {
+				query_profiler* prof = profiler.load(std::memory_order_relaxed);
+				if (prof == nullptr) return format_string(fmt_str.c_str(), std::forward<Values>(values)...);
+
+				auto t0 = std::chrono::steady_clock::now();
+				std::string res = format_string(fmt_str.c_str(), std::forward<Values>(values)...);
+				prof->profile(res).record(query_phase::format, std::chrono::steady_clock::now() - t0);
+				return res;
+			}
+
+			// send a statement and wait for the reply, separating the two phases when profiling
+			int send_query(const std::string& query_str, statement_profile* prof) {
+				if (prof == nullptr) return mysql_real_query(my_conn, query_str.c_str(), query_str.length());
+
+				auto t0 = std::chrono::steady_clock::now();
+				if (mysql_send_query(my_conn, query_str.c_str(), query_str.length()) != 0) return 1;
+
+				auto t1 = std::chrono::steady_clock::now();
+				int ret = mysql_read_query_result(my_conn) ? 1 : 0;
+
+				prof->record(query_phase::send, t1 - t0);
+				prof->record(query_phase::server_wait, std::chrono::steady_clock::now() - t1);
+				return ret;
+			}
+
+			// send a statement under the retry policy, called with the mutex held
+			void real_query(std::unique_lock<std::mutex>& lk, const std::string& query_str, statement_profile* prof = nullptr) {
+				if (my_conn == nullptr) throw mysql_exception(CR_SERVER_GONE_ERROR, "Not connected");
+				bool in_trans = in_transaction();
+
+				for (unsigned int attempt = 1; ; attempt++) {
+					if (send_query(query_str, prof) == 0) {
+						track_schema();
+						return;
+					}
+
+					unsigned int err = mysql_errno(my_conn);
+					if (in_trans || !options.retry.should_retry(err, attempt)) throw mysql_exception{ my_conn };
+
+					wait_before_retry(lk, attempt);
+					if (retry_policy::is_connection_error(err) && !recover()) throw mysql_exception{ my_conn };
+				}
+			}
+
+		public:
+			// open a connection (close the old one if already open), return true if successful
+			bool open(const connect_options& opts) {
+				if (is_open()) close();
 
-				bool ssl_verify = options.ssl_verify_server_cert;
-				mysql_options(my_conn, MYSQL_OPT_SSL_VERIFY_SERVER_CERT, &ssl_verify);
+				std::lock_guard<std::mutex> mg(mutex);
 
-				if (nullptr == mysql_real_connect(my_conn, options.server.c_str(), options.username.c_str(), options.password.c_str(), options.dbname.c_str(), options.port, NULL, options.client_flag)) {
-					mysql_close(my_conn);
-					my_conn = nullptr;
-					return false;
-				}
+				options = opts;
+				my_conn = connect_handle(options);
+				MYSQLPP_PROBE4(connection__open, (const void*)this, options.server.c_str(), options.port, connect_err_number);
+				if (my_conn == nullptr) return false;
 
+				set_schema(options.dbname);
+				check_reconnected();
 				return true;
 			}
 
@@ -831,8 +1587,10 @@ namespace daotk {
 				std::lock_guard<std::mutex> mg(mutex);
 
 				if (my_conn != nullptr) {
+					MYSQLPP_PROBE1(connection__close, (const void*)this);
 					mysql_close(my_conn);
 					my_conn = nullptr;
+					thread_id = 0;
 				}
 			}
 
@@ -855,6 +1613,16 @@ namespace daotk {
 				return my_conn;
 			}
 
+			const connect_options& get_connect_options() const {
+				return options;
+			}
+
+			// database in use: the one the connection was opened with, or the last one selected with USE
+			std::string current_database() const {
+				std::lock_guard<std::mutex> lg(schema_mutex);
+				return schema;
+			}
+
 
 			// wrapping of some functions
 
@@ -871,72 +1639,487 @@ namespace daotk {
 			}
 
 			unsigned int error_code() const {
+				if (my_conn == nullptr) return connect_err_number;
 				return mysql_errno(my_conn);
 			}
 
 			const char* error_message() const {
+				if (my_conn == nullptr) return connect_err_msg.c_str();
 				return mysql_error(my_conn);
 			}
 
+			// switch autocommit mode using the C API rather than a SET statement
+			void set_autocommit(bool mode) {
+				control(mode ? "set autocommit = 1" : "set autocommit = 0", [&] { return mysql_autocommit(my_conn, mode); });
+			}
+
+			bool autocommit() const {
+				return my_conn != nullptr && (my_conn->server_status & SERVER_STATUS_AUTOCOMMIT) != 0;
+			}
+
+			// true between the first statement of a transaction and its commit/rollback
+			bool in_transaction() const {
+				return my_conn != nullptr && (my_conn->server_status & SERVER_STATUS_IN_TRANS) != 0;
+			}
+
+			void commit() {
+				control("commit", [&] { return mysql_commit(my_conn); });
+			}
+
+			void rollback() {
+				control("rollback", [&] { return mysql_rollback(my_conn); });
+			}
+
+			// escape a string for use inside a quoted SQL literal, according to the connection's charset
+			std::string escape_string(const std::string& str) const {
+				std::string res(str.length() * 2 + 1, '\0');
+				unsigned long len = mysql_real_escape_string(my_conn, &res[0], str.c_str(), (unsigned long)str.length());
+				res.resize(len);
+				return res;
+			}
+
+			result run_query(const std::string& query_str, result::resource_type resource) {
+				result res{ nullptr, false, nullptr, nullptr, nullptr, nullptr, resource };
+				query_into(res, query_str);
+				return res;
+			}
+
+			std::vector<result> run_mquery(const std::string& query_str, result::resource_type resource) {
+				auto lk = lock();
+
+				std::vector<result> res;
+				statement_profile* prof = profile_of(query_str);
+				observe(observer, metrics.load(std::memory_order_relaxed), query_event::mquery, query_str.c_str(), query_str.length(), nullptr, [&](query_event& event) {
+					real_query(lk, query_str, prof);
+
+					do {
+						res.push_back(result{ my_conn, true, observer, prof, metrics.load(std::memory_order_relaxed), spill_opts, resource });
+						event.rows += res.back().count_rows();
+					} while (mysql_next_result(my_conn) == 0);
+				});
+
+				return std::move(res);
+			}
+
 		public:
 			// execute query given by string and return result
 			result query(const std::string& query_str) {
-				std::lock_guard<std::mutex> mg(mutex);
-
-				int ret = mysql_real_query(my_conn, query_str.c_str(), query_str.length());
-				if (ret != 0) throw mysql_exception{ my_conn };
-
-				return result{ my_conn, false };
+				return run_query(query_str, nullptr);
 			}
 
 			// execute query with printf-style substitutions and return result
 			template <typename... Values>
 			result query(const std::string& fmt_str, Values... values) {
-				return query( format_string(fmt_str.c_str(), std::forward<Values>(values)...) );
+				return query( format_query(fmt_str, std::forward<Values>(values)...) );
 			}
 
-			// multiple statement query execution
-			std::vector<result> mquery(const std::string& query_str) {
-				std::lock_guard<std::mutex> mg(mutex);
+			// like query(), but into `res', whose rows from a previous query are overwritten in place: once
+			// its storage has grown to the size of the results, running the same query again, e.g. in a
+			// polling loop, allocates no more memory for the rows
+			result& query_into(result& res, const std::string& query_str) {
+				// a result not fetched yet must be discarded before sending another statement
+				res.free(true);
 
-				int ret = mysql_real_query(my_conn, query_str.c_str(), query_str.length());
-				if (ret != 0) throw mysql_exception{ my_conn };
+				auto lk = lock();
+				statement_profile* prof = profile_of(query_str);
+				observe(observer, metrics.load(std::memory_order_relaxed), query_event::query, query_str.c_str(), query_str.length(), nullptr, [&](query_event&) {
+					real_query(lk, query_str, prof);
+				});
 
-				std::vector<result> res;
-				do {
-					res.push_back(result{ my_conn, true });
-				} while (mysql_next_result(my_conn) == 0);
+				res.attach(my_conn, fetch_eagerly(), observer, prof, metrics.load(std::memory_order_relaxed), spill_opts);
+				return res;
+			}
 
-				return std::move(res);
+			template <typename... Values>
+			result& query_into(result& res, const std::string& fmt_str, Values... values) {
+				return query_into(res, format_query(fmt_str, std::forward<Values>(values)...));
+			}
+
+			// multiple statement query execution
+			std::vector<result> mquery(const std::string& query_str) {
+				return run_mquery(query_str, nullptr);
 			}
 
 			// multiple statement query execution with printf-style substitutions and return result
 			template <typename... Values>
 			std::vector<result> mquery(const std::string& fmt_str, Values... values) {
-				return mquery(format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+				return mquery(format_query(fmt_str, std::forward<Values>(values)...));
+			}
+
+#ifdef MYSQLPP_PMR
+			// like query(), with the rows allocated from `resource' (e.g. a std::pmr::monotonic_buffer_resource
+			// per request, released at once), which must outlive the result
+			result query(std::pmr::memory_resource* resource, const std::string& query_str) {
+				return run_query(query_str, resource);
 			}
 
+			template <typename... Values>
+			result query(std::pmr::memory_resource* resource, const std::string& fmt_str, Values... values) {
+				return query(resource, format_query(fmt_str, std::forward<Values>(values)...));
+			}
+
+			std::vector<result> mquery(std::pmr::memory_resource* resource, const std::string& query_str) {
+				return run_mquery(query_str, resource);
+			}
+
+			template <typename... Values>
+			std::vector<result> mquery(std::pmr::memory_resource* resource, const std::string& fmt_str, Values... values) {
+				return mquery(resource, format_query(fmt_str, std::forward<Values>(values)...));
+			}
+#endif
+
 			// like query(), but no result returned
 			void exec(const std::string& query_str) {
-				std::lock_guard<std::mutex> mg(mutex);
+				auto lk = lock();
+				statement_profile* prof = profile_of(query_str);
+				observe(observer, metrics.load(std::memory_order_relaxed), query_event::exec, query_str.c_str(), query_str.length(), nullptr, [&](query_event& event) {
+					real_query(lk, query_str, prof);
+					if (mysql_field_count(my_conn) == 0) event.rows = mysql_affected_rows(my_conn);
 
-				int ret = mysql_real_query(my_conn, query_str.c_str(), query_str.length());
-				if (ret != 0) throw mysql_exception{ my_conn };
-
-				// mysql_use_result must be called for SELECT, SHOW,...
-				// https://dev.mysql.com/doc/refman/8.0/en/mysql-use-result.html
-				MYSQL_RES* myres = mysql_use_result(my_conn);
-				if (myres != nullptr) mysql_free_result(myres);
+					// mysql_use_result must be called for SELECT, SHOW,...
+					// https://dev.mysql.com/doc/refman/8.0/en/mysql-use-result.html
+					MYSQL_RES* myres = mysql_use_result(my_conn);
+					if (myres != nullptr) mysql_free_result(myres);
+				});
 			}
 
 			// like query(), but no result returned
 			template <typename... Values>
 			void exec(const std::string& fmt_str, Values... values) {
-				exec(format_string(fmt_str.c_str(), std::forward<Values>(values)...) );
+				exec(format_query(fmt_str, std::forward<Values>(values)...) );
+			}
+
+			// execute query under a deadline and return its result, already fetched;
+			// throw mysqlpp_exception(query_timeout) if the deadline passed
+			result query(const deadline& dl, const std::string& query_str) {
+				auto lk = lock();
+
+				result res;
+				statement_profile* prof = profile_of(query_str);
+				observe(observer, metrics.load(std::memory_order_relaxed), query_event::query, query_str.c_str(), query_str.length(), nullptr, [&](query_event&) {
+					run_with_deadline(dl, query_str, [&](const std::string& sql) {
+						real_query(lk, sql, prof);
+						res = result{ my_conn, true, observer, prof, metrics.load(std::memory_order_relaxed), spill_opts };
+					});
+				});
+				return res;
+			}
+
+			template <typename... Values>
+			result query(const deadline& dl, const std::string& fmt_str, Values... values) {
+				return query(dl, format_query(fmt_str, std::forward<Values>(values)...));
+			}
+
+			// like query() under a deadline, but no result returned
+			void exec(const deadline& dl, const std::string& query_str) {
+				auto lk = lock();
+				statement_profile* prof = profile_of(query_str);
+
+				observe(observer, metrics.load(std::memory_order_relaxed), query_event::exec, query_str.c_str(), query_str.length(), nullptr, [&](query_event& event) {
+					run_with_deadline(dl, query_str, [&](const std::string& sql) {
+						real_query(lk, sql, prof);
+						if (mysql_field_count(my_conn) == 0) event.rows = mysql_affected_rows(my_conn);
+
+						MYSQL_RES* myres = mysql_use_result(my_conn);
+						if (myres != nullptr) mysql_free_result(myres);
+					});
+				});
+			}
+
+			template <typename... Values>
+			void exec(const deadline& dl, const std::string& fmt_str, Values... values) {
+				exec(dl, format_query(fmt_str, std::forward<Values>(values)...));
+			}
+
+			// canceller used to interrupt statements running past their deadline (see `query_canceller');
+			// without one, deadlines only rely on the MAX_EXECUTION_TIME hint and the network timeouts
+			void set_canceller(std::shared_ptr<query_canceller> qc) {
+				std::lock_guard<std::mutex> mg(mutex);
+				canceller = std::move(qc);
+			}
+
+			// memory budget of the results of this connection, beyond which their rows are stored in
+			// temporary files (see `spill_options'); spilled rows are read back through a memory mapping,
+			// transparently for `seek', `each' and iterators. Results that spill are streamed from the server
+			void set_spill_options(const spill_options& opts) {
+				std::lock_guard<std::mutex> mg(mutex);
+				spill_opts = opts.memory_limit > 0 ? std::make_shared<const spill_options>(opts) : nullptr;
+			}
+
+			spill_options get_spill_options() {
+				std::lock_guard<std::mutex> mg(mutex);
+				return spill_opts ? *spill_opts : spill_options();
+			}
+
+			// instrumentation hook called around every statement (see `query_observer'), nullptr to remove;
+			// the observer must outlive the connection and the results it returns
+			void set_observer(query_observer* obs) {
+				std::lock_guard<std::mutex> mg(mutex);
+				observer = obs;
+			}
+
+			query_observer* get_observer() const {
+				return observer;
+			}
+
+			// metrics registry updated by this connection and its statements (see `metrics_registry'), nullptr to remove;
+			// the registry can be shared by many connections and must outlive them and their results
+			void set_metrics(metrics_registry* m) {
+				metrics.store(m, std::memory_order_relaxed);
+			}
+
+			metrics_registry* get_metrics() const {
+				return metrics.load(std::memory_order_relaxed);
+			}
+
+			// per-phase statement profiler (see `query_profiler'), nullptr to remove; profiling stays off,
+			// at the cost of one atomic load per statement, until a profiler is attached
+			void set_profiler(query_profiler* prof) {
+				profiler.store(prof, std::memory_order_relaxed);
+			}
+
+			query_profiler* get_profiler() const {
+				return profiler.load(std::memory_order_relaxed);
+			}
+
+			// `single_owner' binds the connection to the calling thread and stops locking it for statements;
+			// a connection set up on another thread is passed on with `take_ownership'
+			// (the mode must not change while other threads may use the connection)
+			void set_threading_mode(threading_mode m) {
+				std::lock_guard<std::mutex> mg(mutex);
+				mode = m;
+				owner = std::this_thread::get_id();
+			}
+
+			threading_mode get_threading_mode() const {
+				return mode;
+			}
+
+			// transfer a single-owner connection to the calling thread; the previous owner must have
+			// stopped using it, and the handover must synchronize the two threads (e.g. a queue or a join)
+			void take_ownership() {
+				owner = std::this_thread::get_id();
+			}
+
+			// contention on the connection's mutex since it was created (nothing is counted in single-owner mode)
+			lock_statistics lock_stats() const {
+				lock_statistics res;
+				res.acquisitions = lock_acquisitions.load(std::memory_order_relaxed);
+				res.contended = lock_contentions.load(std::memory_order_relaxed);
+				res.wait_time = std::chrono::nanoseconds(lock_wait_ns.load(std::memory_order_relaxed));
+				res.max_wait = std::chrono::nanoseconds(lock_max_wait_ns.load(std::memory_order_relaxed));
+				return res;
+			}
+
+			// server-side id of this connection, as used by KILL
+			unsigned long server_thread_id() const {
+				return thread_id;
+			}
+
+			// run `fn(connection&)', typically a whole transaction, again when it throws a retryable error
+			template <typename Function>
+			void with_retry(Function fn) {
+				for (unsigned int attempt = 1; ; attempt++) {
+					try {
+						fn(*this);
+						return;
+					}
+					catch (mysql_exception& exp) {
+						unsigned int err = exp.error_number();
+						if (!options.retry.should_retry(err, attempt)) throw;
+
+						auto lk = lock();
+						if (in_transaction()) mysql_rollback(my_conn);
+
+						wait_before_retry(lk, attempt);
+						if (retry_policy::is_connection_error(err) && !recover()) throw;
+					}
+				}
+			}
+
+			const retry_policy& get_retry_policy() const {
+				return options.retry;
+			}
+
+			void set_retry_policy(const retry_policy& policy) {
+				std::lock_guard<std::mutex> mg(mutex);
+				options.retry = policy;
+			}
+		};
+
+
+
+
+
+
+		// cancels statements that run past their deadline by sending KILL QUERY from a side connection,
+		// so the connection running the statement (and its mutex) is never touched;
+		// one canceller can be shared by many connections to the same server
+		class query_canceller {
+		protected:
+			using clock = std::chrono::steady_clock;
+
+			struct entry {
+				unsigned long thread_id;
+				bool fired;
+				bool sending;				// the KILL is being sent, `disarm' waits for it
+			};
+
+			connect_options options;
+			connection side;				// used by the worker thread only
+			std::atomic<unsigned long long> num_failures{ 0 };
+
+			std::mutex mutex;
+			std::condition_variable cv;
+			std::condition_variable sent;
+			std::map<unsigned long long, entry> entries;
+			std::multimap<clock::time_point, unsigned long long> deadlines;
+			unsigned long long next_token = 0;
+			bool stopping = false;
+
+			std::thread worker;
+
+
+			void kill(unsigned long thread_id) {
+				try {
+					// a side connection closed meanwhile (wait_timeout...) is opened again
+					if (!side.is_open() && !side.open(options)) throw std::runtime_error(side.error_message());
+					side.exec("kill query %lu", thread_id);
+				}
+				catch (std::exception&) {
+					num_failures++;
+				}
+			}
+
+			void run() {
+				thread_init_guard tg;
+				std::unique_lock<std::mutex> lk(mutex);
+
+				while (!stopping) {
+					if (deadlines.empty()) {
+						cv.wait(lk);
+						continue;
+					}
+
+					auto first = deadlines.begin();
+					if (clock::now() < first->first) {
+						cv.wait_until(lk, first->first);
+						continue;
+					}
+
+					unsigned long long token = first->second;
+					deadlines.erase(first);
+
+					auto itr = entries.find(token);
+					if (itr == entries.end()) continue;
+
+					// sent without the mutex, so that a slow KILL does not hold up `arm' and `disarm'
+					itr->second.fired = true;
+					itr->second.sending = true;
+					unsigned long thread_id = itr->second.thread_id;
+
+					lk.unlock();
+					kill(thread_id);
+					lk.lock();
+
+					itr->second.sending = false;		// not erased while sending
+					sent.notify_all();
+				}
+			}
+
+		public:
+			query_canceller(const query_canceller&) = delete;
+			void operator =(const query_canceller&) = delete;
+
+			// `options' are used for the side connection, which needs the privilege to kill the other sessions;
+			// throws std::runtime_error if it cannot connect
+			query_canceller(const connect_options& _options)
+				: options(_options), side(_options)
+			{
+				if (!side) throw std::runtime_error(std::string("Failed to connect: ") + side.error_message());
+				worker = std::thread(&query_canceller::run, this);
+			}
+
+			virtual ~query_canceller() {
+				{
+					std::lock_guard<std::mutex> lg(mutex);
+					stopping = true;
+				}
+				cv.notify_one();
+				worker.join();
+			}
+
+			// schedule a kill of the statement running on server thread `thread_id' at time `at'
+			unsigned long long arm(unsigned long thread_id, clock::time_point at) {
+				unsigned long long token;
+				{
+					std::lock_guard<std::mutex> lg(mutex);
+					token = ++next_token;
+					entries[token] = entry{ thread_id, false, false };
+					deadlines.emplace(at, token);
+				}
+				cv.notify_one();
+				return token;
+			}
+
+			// cancel a scheduled kill, return true if it was already sent (waiting for a KILL being sent,
+			// so that it cannot hit a later statement of the same session)
+			bool disarm(unsigned long long token) {
+				std::unique_lock<std::mutex> lk(mutex);
+
+				auto itr = entries.find(token);
+				if (itr == entries.end()) return false;
+
+				sent.wait(lk, [&] { return !itr->second.sending; });
+				bool fired = itr->second.fired;
+				entries.erase(itr);
+				return fired;
+			}
+
+			// KILL QUERY that could not be sent, e.g. the side connection could not be reopened
+			unsigned long long failures() const {
+				return num_failures;
 			}
 		};
 
 
+		template <typename Function>
+		void connection::run_with_deadline(const deadline& dl, const std::string& query_str, Function fn) {
+			long long ms = dl.timeout.count();
+			if (ms < 1) throw mysqlpp_exception(mysqlpp_exception::query_timeout);
+
+			std::string sql = query_str;
+			if (dl.execution_time_hint) {
+				// the hint must follow the SELECT keyword: SELECT /*+ MAX_EXECUTION_TIME(N) */ ...
+				std::size_t pos = sql.find_first_not_of(" \t\r\n(");
+				bool is_select = (pos != std::string::npos && sql.length() - pos > 6);
+				for (std::size_t i = 0; is_select && i < 6; i++)
+					is_select = (std::tolower((unsigned char)sql[pos + i]) == "select"[i]);
+
+				if (is_select)
+					sql.insert(pos + 6, format_string(" /*+ MAX_EXECUTION_TIME(%lld) */", ms));
+			}
+
+			std::shared_ptr<query_canceller> qc = canceller;
+			unsigned long long token = 0;
+			if (qc) token = qc->arm(thread_id, std::chrono::steady_clock::now() + dl.timeout);
+
+			try {
+				fn(sql);
+			}
+			catch (mysql_exception& exp) {
+				bool killed = qc && qc->disarm(token);
+				if (exp.error_number() == ER_QUERY_TIMEOUT || (killed && exp.error_number() == ER_QUERY_INTERRUPTED))
+					throw mysqlpp_exception(mysqlpp_exception::query_timeout);
+				throw;
+			}
+			catch (...) {
+				if (qc) qc->disarm(token);
+				throw;
+			}
+
+			if (qc) qc->disarm(token);
+		}
 
 
 
@@ -1258,17 +2441,102 @@ namespace daotk {
 			mysql_bind_set param_binds;
 			mysql_bind_set result_binds;
 
-		public:
-			prepared_stmt(connection& pcon, const std::string& query)
-				: con(pcon), stmt(nullptr, [](MYSQL_STMT* stmt) { mysql_stmt_close(stmt); }), param_binds(0), result_binds(0)
-			{
-				std::unique_lock<std::mutex> lck(con.mutex);
+			std::string query_str;
+			unsigned long long generation = 0;	// connection generation the statement was prepared on
+
+			// set by `fetch_all': the struct its result is bound to, and columns that no field reads
+			std::shared_ptr<void> bound_struct;
+			std::vector<std::string> unread_columns;
+			query_profiler* profiled_by = nullptr;
+			statement_profile* stmt_profile = nullptr;
+
+			// (re)create the statement on the server, called with the connection mutex held
+			bool prepare() {
 				stmt.reset(mysql_stmt_init(con.my_conn));
 
 				if (!stmt) // Out of memory is the only returned error
 					throw std::bad_alloc();
 
-				if (mysql_stmt_prepare(stmt.get(), query.c_str(), query.size()))
+				generation = con.generation;
+				bool ok = mysql_stmt_prepare(stmt.get(), query_str.c_str(), query_str.size()) == 0;
+				MYSQLPP_PROBE3(stmt__prepare, (const void*)this, query_str.c_str(), ok);
+				return ok;
+			}
+
+			// execute under the connection's retry policy; after a reconnection the statement is
+			// re-prepared and the bound variables are bound again before executing
+			bool execute_impl(std::unique_lock<std::mutex>& lck) {
+				con.check_reconnected();
+				bool in_trans = con.in_transaction();
+
+				bool stale = false;
+				for (unsigned int attempt = 1; ; attempt++) {
+					if (stale || generation != con.generation) {
+						if (!prepare()) return false;
+						stale = false;
+					}
+
+					param_binds.pre_execute();
+					if (mysql_stmt_bind_param(stmt.get(), param_binds.binds()))
+						return false;
+					if (mysql_stmt_execute(stmt.get()) == 0)
+						break;
+
+					unsigned int err = mysql_stmt_errno(stmt.get());
+					if (attempt == 1 && (err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE)) {
+						// the server no longer knows the statement, e.g. after a silent reconnection
+						stale = true;
+						continue;
+					}
+
+					if (in_trans || !con.options.retry.should_retry(err, attempt))
+						return false;
+
+					con.wait_before_retry(lck, attempt);
+					if (retry_policy::is_connection_error(err)) {
+						if (!con.recover()) return false;
+						stale = true;
+					}
+				}
+
+				param_binds.post_execute();
+				return true;
+			}
+
+			// profile of the statement, looked up again only when the connection's profiler changes
+			statement_profile* profile() {
+				query_profiler* prof = con.profiler.load(std::memory_order_relaxed);
+				if (prof != profiled_by) {
+					profiled_by = prof;
+					stmt_profile = prof ? &prof->profile(query_str) : nullptr;
+				}
+				return stmt_profile;
+			}
+
+			bool fetch_impl() {
+				result_binds.pre_fetch();
+				if (mysql_stmt_bind_result(stmt.get(), result_binds.binds()))
+					return false;
+				int rc = mysql_stmt_fetch(stmt.get());
+				if (rc == MYSQL_DATA_TRUNCATED || rc == 0) {
+					auto refetch = result_binds.post_fetch();
+					for (auto& i : refetch) {
+						if (mysql_stmt_fetch_column(stmt.get(), &result_binds.binds()[i], (unsigned int)i, 0))
+							return false;
+					}
+					result_binds.post_refetch(refetch);
+					return true;
+				}
+				else return false;
+			}
+
+		public:
+			prepared_stmt(connection& pcon, const std::string& query)
+				: con(pcon), stmt(nullptr, [](MYSQL_STMT* stmt) { mysql_stmt_close(stmt); }), param_binds(0), result_binds(0), query_str(query)
+			{
+				auto lck = con.lock();
+
+				if (!prepare())
 					throw std::runtime_error(std::string("Failed to prepare stmt: ") + mysql_stmt_error(stmt.get()));
 
 				auto param_count = mysql_stmt_param_count(stmt.get());
@@ -1289,21 +2557,10 @@ namespace daotk {
 			{}
 
 			virtual ~prepared_stmt() {
-				std::unique_lock<std::mutex> lck(con.mutex);
+				auto lck = con.lock();
 				stmt.reset();
 			}
 
-			bool execute() {
-				std::unique_lock<std::mutex> lck(con.mutex);
-				param_binds.pre_execute();
-				if (mysql_stmt_bind_param(stmt.get(), param_binds.binds()))
-					return false;
-				if (mysql_stmt_execute(stmt.get()))
-					return false;
-				param_binds.post_execute();
-				return true;
-			}
-
 			template<typename... Args>
 			void bind_param(const Args &... args) {
 				param_binds.bind_variables(args...);
@@ -1314,22 +2571,83 @@ namespace daotk {
 				result_binds.bind_variables(args...);
 			}
 
+			// bind the result to the fields of `s' declared with MYSQLPP_FIELDS, matching the columns by name
+			template <typename Struct, typename = typename std::enable_if<has_fields<Struct>::value>::type>
+			void bind_result(Struct& s) {
+				auto lck = con.lock();
+
+				std::unique_ptr<MYSQL_RES, decltype(&mysql_free_result)> meta(mysql_stmt_result_metadata(stmt.get()), mysql_free_result);
+				if (!meta) throw std::logic_error("The statement returns no result set");
+
+				unsigned int num_fields = mysql_num_fields(meta.get());
+				MYSQL_FIELD* fields = mysql_fetch_fields(meta.get());
+
+				std::vector<int> columns;
+				match_columns<Struct>(num_fields, [&](unsigned int c) { return fields[c].name; }, columns);
+
+				std::vector<bool> bound(num_fields);
+				for_each_field<Struct>([&](const auto& field, std::size_t k) {
+					if (columns[k] < 0) return;
+					result_binds.set_variable((std::size_t)columns[k], s.*(field.member));
+					bound[columns[k]] = true;
+				});
+
+				// every column needs a buffer: the others are read into placeholders
+				unread_columns.assign(num_fields, std::string());
+				for (unsigned int c = 0; c < num_fields; c++)
+					if (!bound[c]) result_binds.set_variable(c, unread_columns[c]);
+			}
+
+			bool execute() {
+				auto lck = con.lock();
+				statement_profile* prof = profile();
+
+				bool ok = false;
+				observe(con.observer, con.metrics.load(std::memory_order_relaxed), query_event::stmt_execute, query_str.c_str(), query_str.length(), this, [&](query_event& event) {
+					auto t0 = prof ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+					ok = execute_impl(lck);
+					if (prof) prof->record(query_phase::server_wait, std::chrono::steady_clock::now() - t0);
+					if (!ok) event.error = mysql_stmt_errno(stmt.get());
+					else if (mysql_stmt_field_count(stmt.get()) == 0) event.rows = mysql_stmt_affected_rows(stmt.get());
+				});
+				return ok;
+			}
+
 			bool fetch() {
-				std::unique_lock<std::mutex> lck(con.mutex);
-				result_binds.pre_fetch();
-				if (mysql_stmt_bind_result(stmt.get(), result_binds.binds()))
-					return false;
-				int rc = mysql_stmt_fetch(stmt.get());
-				if (rc == MYSQL_DATA_TRUNCATED || rc == 0) {
-					auto refetch = result_binds.post_fetch();
-					for (auto& i : refetch) {
-						if (mysql_stmt_fetch_column(stmt.get(), &result_binds.binds()[i], (unsigned int)i, 0))
-							return false;
-					}
-					result_binds.post_refetch(refetch);
-					return true;
+				auto lck = con.lock();
+				statement_profile* prof = profile();
+
+				bool ok = false;
+				observe(con.observer, con.metrics.load(std::memory_order_relaxed), query_event::stmt_fetch, query_str.c_str(), query_str.length(), this, [&](query_event& event) {
+					auto t0 = prof ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+					ok = fetch_impl();
+					if (prof) prof->record(query_phase::transfer, std::chrono::steady_clock::now() - t0);
+					if (ok) event.rows = 1;
+					else event.error = mysql_stmt_errno(stmt.get());
+				});
+				return ok;
+			}
+
+			// fetch the remaining rows into `structs', reusing its elements; return the number of rows
+			// (the result stays bound to a struct held by the statement)
+			template <typename Struct>
+			std::size_t fetch_all(std::vector<Struct>& structs) {
+				std::shared_ptr<Struct> row = std::make_shared<Struct>();
+				bind_result(*row);
+				bound_struct = row;
+
+				std::size_t n = 0;
+				for (; fetch(); n++) {
+					if (n < structs.size()) structs[n] = *row;
+					else structs.push_back(*row);
 				}
-				else return false;
+				structs.resize(n);
+				return n;
+			}
+
+			// rows changed by the last execution of an INSERT, UPDATE or DELETE statement
+			unsigned long long affected_rows() const {
+				return mysql_stmt_affected_rows(stmt.get());
 			}
 
 			unsigned int error_code() const {
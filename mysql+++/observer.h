@@ -0,0 +1,75 @@
+#pragma once
+
+
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <initializer_list>
+
+
+namespace daotk {
+	namespace mysql {
+
+		// one instrumented operation, as seen by a `query_observer'
+		struct query_event {
+			enum kind_type {
+				query,				// connection::query
+				exec,				// connection::exec
+				mquery,				// connection::mquery
+				stmt_execute,		// prepared_stmt::execute
+				stmt_fetch,			// prepared_stmt::fetch (one row)
+				result_fetch		// transfer of a query result into a `result' object
+			};
+
+			kind_type kind;
+			const char* sql;					// statement text (not null-terminated), nullptr for result_fetch
+			std::size_t sql_length;
+			const void* stmt;					// identifies the prepared statement, nullptr for text queries
+
+			// only meaningful in `on_end'
+			std::chrono::nanoseconds duration;
+			unsigned long long rows;			// rows affected (exec, stmt_execute) or received (fetches)
+			unsigned long long bytes;			// bytes of field data received
+			unsigned int error;					// MySQL error code, 0 if successful
+		};
+
+
+		// instrumentation interface; observers are called on the thread making the call, while the
+		// connection is locked, so they must be thread-safe and must not use the connection
+		class query_observer {
+		public:
+			virtual ~query_observer() {}
+
+			virtual void on_start(const query_event&) {}
+			virtual void on_end(const query_event&) {}
+		};
+
+
+		// forwards events to several observers, in the order they were added
+		class observer_list : public query_observer {
+		protected:
+			std::vector<query_observer*> observers;
+
+		public:
+			observer_list() {}
+
+			observer_list(std::initializer_list<query_observer*> list)
+				: observers(list)
+			{}
+
+			void add(query_observer* observer) {
+				observers.push_back(observer);
+			}
+
+			virtual void on_start(const query_event& event) override {
+				for (auto o : observers)
+					o->on_start(event);
+			}
+
+			virtual void on_end(const query_event& event) override {
+				for (auto o : observers)
+					o->on_end(event);
+			}
+		};
+	}
+}
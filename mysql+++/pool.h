@@ -0,0 +1,268 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "mysql+++.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		struct pool_options {
+			std::size_t max_size = 8;							// maximum number of open connections
+			std::chrono::milliseconds acquire_timeout{ 5000 };	// how long `acquire' waits for a free connection
+			std::chrono::milliseconds validate_after{ 30000 };	// idle time after which `acquire' pings a connection before lending it
+			std::string name = "default";						// `pool' label of the pool's metrics
+			metrics_registry* metrics = nullptr;				// also attached to the pool's connections
+		};
+
+
+		class connection_pool;
+
+
+		// connection borrowed from a `connection_pool', given back on destruction
+		class pooled_connection {
+			friend class connection_pool;
+
+		public:
+			struct entry {
+				std::shared_ptr<connection> conn;
+				std::map<std::string, std::unique_ptr<prepared_stmt>> statements;		// prepared on this connection, by SQL text
+				std::chrono::steady_clock::time_point released_at;
+			};
+
+		protected:
+			connection_pool* pool = nullptr;
+			std::unique_ptr<entry> e;
+
+			pooled_connection(connection_pool* _pool, std::unique_ptr<entry> _e)
+				: pool(_pool), e(std::move(_e))
+			{}
+
+		public:
+			pooled_connection() {}
+
+			pooled_connection(const pooled_connection&) = delete;
+			void operator =(const pooled_connection&) = delete;
+
+			pooled_connection(pooled_connection&& pc) noexcept
+				: pool(pc.pool), e(std::move(pc.e))
+			{
+				pc.pool = nullptr;
+			}
+
+			pooled_connection& operator =(pooled_connection&& pc) noexcept {
+				release();
+				pool = pc.pool;
+				e = std::move(pc.e);
+				pc.pool = nullptr;
+				return *this;
+			}
+
+			virtual ~pooled_connection() {
+				release();
+			}
+
+			// give the connection back to its pool now
+			void release();
+
+			connection& operator *() const {
+				return *e->conn;
+			}
+
+			connection* operator ->() const {
+				return e->conn.get();
+			}
+
+			explicit operator bool() const {
+				return e != nullptr;
+			}
+
+			// prepared statement cached with the connection, so it is prepared once per connection
+			prepared_stmt& prepare(const std::string& sql) {
+				auto& st = e->statements[sql];
+				if (!st) st.reset(new prepared_stmt(*e->conn, sql));
+				return *st;
+			}
+		};
+
+
+		// pool of connections to one server; each pool has its own lock, so independent pools
+		// (e.g. one per shard) never contend with each other
+		//
+		// the pool must outlive the connections borrowed from it
+		class connection_pool {
+			friend class pooled_connection;
+
+		public:
+			struct statistics {
+				std::size_t open;							// connections currently open
+				std::size_t idle;
+				unsigned long long acquisitions;
+				unsigned long long waits;					// acquisitions that had to wait for a connection
+				unsigned long long timeouts;				// acquisitions that failed after `acquire_timeout'
+			};
+
+		protected:
+			connect_options options;
+			pool_options popts;
+
+			std::mutex mutex;
+			std::condition_variable available;
+			std::vector<std::unique_ptr<pooled_connection::entry>> idle;
+			std::size_t num_open = 0;
+
+			std::atomic<unsigned long long> num_acquisitions{ 0 };
+			std::atomic<unsigned long long> num_waits{ 0 };
+			std::atomic<unsigned long long> num_timeouts{ 0 };
+
+			metric_gauge* in_use_gauge = nullptr;
+			metric_gauge* open_gauge = nullptr;
+			metric_counter* waits_counter = nullptr;
+			metric_counter* timeouts_counter = nullptr;
+
+
+			std::unique_ptr<pooled_connection::entry> create() {
+				std::unique_ptr<pooled_connection::entry> e(new pooled_connection::entry());
+				e->conn = std::make_shared<connection>();
+				if (popts.metrics != nullptr) e->conn->set_metrics(popts.metrics);
+
+				if (!e->conn->open(options))
+					throw std::runtime_error(std::string("Failed to connect: ") + e->conn->error_message());
+				return e;
+			}
+
+			void give_back(std::unique_ptr<pooled_connection::entry> e) {
+				// a connection left in a transaction is rolled back; one whose last error was a lost connection
+				// is dropped (without a round trip: idle connections are checked by `acquire')
+				bool usable = e->conn->get_raw_connection() != nullptr && !retry_policy::is_connection_error(e->conn->error_code());
+				if (usable) {
+					try {
+						if (e->conn->in_transaction()) e->conn->rollback();
+					}
+					catch (...) {
+						usable = false;
+					}
+				}
+
+				e->released_at = std::chrono::steady_clock::now();
+				{
+					std::lock_guard<std::mutex> lg(mutex);
+					if (usable) idle.push_back(std::move(e));
+					else num_open--;
+				}
+				available.notify_one();
+
+				if (in_use_gauge != nullptr) in_use_gauge->sub();
+				if (!usable && open_gauge != nullptr) open_gauge->sub();
+			}
+
+		public:
+			connection_pool(const connection_pool&) = delete;
+			void operator =(const connection_pool&) = delete;
+
+			connection_pool(const connect_options& _options, const pool_options& _popts = pool_options())
+				: options(_options), popts(_popts)
+			{
+				if (popts.max_size == 0) popts.max_size = 1;
+
+				if (popts.metrics != nullptr) {
+					std::string labels = "pool=\"" + popts.name + "\"";
+					in_use_gauge = &popts.metrics->gauge("pool_connections_in_use", "Pooled connections currently borrowed.", labels);
+					open_gauge = &popts.metrics->gauge("pool_connections_open", "Pooled connections currently open.", labels);
+					waits_counter = &popts.metrics->counter("pool_acquire_waits_total", "Pool acquisitions that had to wait.", labels);
+					timeouts_counter = &popts.metrics->counter("pool_acquire_timeouts_total", "Pool acquisitions that timed out.", labels);
+				}
+			}
+
+			// borrow a connection, opening a new one if none is idle and the pool is not full;
+			// throw mysqlpp_exception(pool_exhausted) if none is available within `acquire_timeout'
+			pooled_connection acquire() {
+				num_acquisitions++;
+				std::unique_ptr<pooled_connection::entry> e;
+
+				{
+					std::unique_lock<std::mutex> lk(mutex);
+
+					if (idle.empty() && num_open >= popts.max_size) {
+						num_waits++;
+						if (waits_counter != nullptr) waits_counter->add();
+
+						if (!available.wait_for(lk, popts.acquire_timeout, [this] { return !idle.empty() || num_open < popts.max_size; })) {
+							num_timeouts++;
+							if (timeouts_counter != nullptr) timeouts_counter->add();
+							throw mysqlpp_exception(mysqlpp_exception::pool_exhausted);
+						}
+					}
+
+					if (!idle.empty()) {
+						e = std::move(idle.back());
+						idle.pop_back();
+					}
+					else num_open++;
+				}
+
+				// a connection idle for a while may have been closed by the server (wait_timeout): replace it
+				if (e && std::chrono::steady_clock::now() - e->released_at >= popts.validate_after && !e->conn->is_open()) {
+					e.reset();
+					if (open_gauge != nullptr) open_gauge->sub();
+				}
+
+				if (!e) {
+					// connect without holding the pool's lock
+					try {
+						e = create();
+					}
+					catch (...) {
+						{
+							std::lock_guard<std::mutex> lg(mutex);
+							num_open--;
+						}
+						available.notify_one();
+						throw;
+					}
+
+					if (open_gauge != nullptr) open_gauge->add();
+				}
+
+				if (in_use_gauge != nullptr) in_use_gauge->add();
+				return pooled_connection(this, std::move(e));
+			}
+
+			statistics stats() {
+				std::lock_guard<std::mutex> lg(mutex);
+
+				statistics res;
+				res.open = num_open;
+				res.idle = idle.size();
+				res.acquisitions = num_acquisitions.load();
+				res.waits = num_waits.load();
+				res.timeouts = num_timeouts.load();
+				return res;
+			}
+
+			const connect_options& get_connect_options() const {
+				return options;
+			}
+
+			const pool_options& get_pool_options() const {
+				return popts;
+			}
+		};
+
+
+		inline void pooled_connection::release() {
+			if (pool != nullptr && e) pool->give_back(std::move(e));
+			pool = nullptr;
+		}
+	}
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <utility>
+#include <tuple>
+#include <vector>
+#include <type_traits>
+
+#include "mysql+++.h"
+#include "lockfree.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		namespace prefetch_detail {
+			// rows are tuples of `Values', or a single struct declaring its fields (see MYSQLPP_FIELDS)
+			template <typename... Values>
+			struct row_of {
+				using is_struct = std::false_type;
+				using type = std::tuple<Values...>;
+			};
+
+			template <typename Value>
+			struct row_of<Value> {
+				using is_struct = has_fields<Value>;
+				using type = typename std::conditional<is_struct::value, Value, std::tuple<Value>>::type;
+			};
+		}
+
+
+		// streaming result reader: a dedicated thread receives and decodes rows of an unbuffered
+		// result (mysql_use_result) into a bounded ring while the consumer processes earlier rows
+		//
+		// the connection stays locked by the fetch thread until the whole result has been read or
+		// the reader is cancelled/destroyed, so the connection must not be used from inside `each'
+		//
+		// a cancellation interrupts the statement with KILL QUERY through the canceller of the connection
+		// (see `connection::set_canceller'); without one, the rest of the result is read off and discarded
+		//
+		// with a single struct declaring its fields as `Values' (prefetch_reader<person>), rows are
+		// decoded into that struct, its fields matched by name with the columns of the result
+		template <typename... Values>
+		class prefetch_reader {
+		public:
+			using row_type = typename prefetch_detail::row_of<Values...>::type;
+
+		protected:
+			using is_struct = typename prefetch_detail::row_of<Values...>::is_struct;
+
+			connection& con;
+			spsc_ring<row_type> ring;
+			std::vector<int> columns;		// of the fields of a struct row
+
+			std::atomic<bool> cancelled{ false };
+			std::atomic<bool> finished{ false };
+			std::exception_ptr error;
+			std::size_t num_rows = 0;
+
+			// a side waiting for the ring (consumer: a row, producer: room) sleeps on `wait_cv'
+			std::mutex wait_mutex;
+			std::condition_variable wait_cv;
+			std::atomic<bool> consumer_waiting{ false };
+			std::atomic<bool> producer_waiting{ false };
+
+			// statement to kill on cancellation, while it runs
+			std::mutex cancel_mutex;
+			std::shared_ptr<query_canceller> canceller;
+			unsigned long server_thread = 0;
+			unsigned long long kill_token = 0;
+
+			std::thread worker;
+
+
+			// wait until `ready()' after a short spin, `waiting' telling the other side to wake us up
+			template <typename Predicate>
+			void block(std::atomic<bool>& waiting, Predicate ready) {
+				for (int i = 0; i < 64; i++) {
+					if (ready()) return;
+					std::this_thread::yield();
+				}
+
+				std::unique_lock<std::mutex> lk(wait_mutex);
+				waiting.store(true);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				wait_cv.wait(lk, ready);
+				waiting.store(false, std::memory_order_relaxed);
+			}
+
+			// wake up the other side if it waits in `block'
+			void wake(std::atomic<bool>& waiting) {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (!waiting.load(std::memory_order_relaxed)) return;
+
+				{
+					std::lock_guard<std::mutex> lg(wait_mutex);
+				}
+				wait_cv.notify_all();
+			}
+
+			bool has_room() const {
+				return ring.size() <= ring.capacity() / 2 || cancelled.load(std::memory_order_relaxed);
+			}
+
+
+			template <std::size_t... I>
+			void decode_row(MYSQL_ROW row, unsigned int num_fields, row_type& data, std::index_sequence<I...>) {
+				int dummy[] = { 0, ((I < num_fields ? (void)parse_field(row[I], std::get<I>(data)) : (void)0), 0)... };
+				(void)dummy;
+			}
+
+			void decode(MYSQL_RES* res, MYSQL_ROW row, unsigned int num_fields, row_type& data, std::false_type) {
+				(void)res;
+				decode_row(row, num_fields, data, std::index_sequence_for<Values...>{});
+			}
+
+			void decode(MYSQL_RES* res, MYSQL_ROW row, unsigned int num_fields, row_type& data, std::true_type) {
+				(void)num_fields;
+				unsigned long* lengths = mysql_fetch_lengths(res);
+				decode_struct(data, columns, [&](unsigned int c, std::size_t& len) {
+					len = lengths[c];
+					return row[c];
+				});
+			}
+
+			void match(MYSQL_RES* res, unsigned int num_fields, std::false_type) {
+				(void)res;
+				(void)num_fields;
+			}
+
+			void match(MYSQL_RES* res, unsigned int num_fields, std::true_type) {
+				MYSQL_FIELD* fields = mysql_fetch_fields(res);
+				match_columns<row_type>(num_fields, [&](unsigned int c) { return fields[c].name; }, columns);
+			}
+
+			template <typename Function, std::size_t... I>
+			bool call(Function& callback, row_type& data, std::index_sequence<I...>) {
+				return callback(std::move(std::get<I>(data))...);
+			}
+
+			template <typename Function>
+			bool call(Function& callback, row_type& data, std::false_type) {
+				return call(callback, data, std::index_sequence_for<Values...>{});
+			}
+
+			template <typename Function>
+			bool call(Function& callback, row_type& data, std::true_type) {
+				return callback(std::move(data));
+			}
+
+			template <typename... Refs>
+			bool fetch_row(std::false_type, Refs&... values) {
+				row_type data;
+				if (!next(data)) return false;
+
+				std::tie(values...) = std::move(data);
+				return true;
+			}
+
+			bool fetch_row(std::true_type, row_type& data) {
+				return next(data);
+			}
+
+			void run(const std::string query_str) {
+				thread_init_guard tg;
+
+				// a single-owner connection is lent to this thread, its owner must not use it meanwhile
+				std::unique_lock<std::mutex> lk;
+				if (con.get_threading_mode() == threading_mode::shared) lk = con.lock();
+				MYSQL* my_conn = con.my_conn;
+
+				{
+					std::lock_guard<std::mutex> lg(cancel_mutex);
+					canceller = con.canceller;
+					server_thread = con.thread_id;
+				}
+
+				try {
+					observe(con.observer, con.metrics.load(std::memory_order_relaxed), query_event::query, query_str.c_str(), query_str.length(), nullptr, [&](query_event& event) {
+						if (cancelled.load(std::memory_order_relaxed)) return;
+						if (mysql_real_query(my_conn, query_str.c_str(), query_str.length()) != 0) {
+							if (cancelled.load(std::memory_order_relaxed)) return;
+							throw mysql_exception{ my_conn };
+						}
+
+						// after a KILL QUERY the server ends the result, otherwise mysql_free_result reads off its rows
+						std::unique_ptr<MYSQL_RES, decltype(&mysql_free_result)> res(mysql_use_result(my_conn), mysql_free_result);
+						if (res) {
+							unsigned int num_fields = mysql_num_fields(res.get());
+							match(res.get(), num_fields, is_struct{});
+
+							while (!cancelled.load(std::memory_order_relaxed)) {
+								MYSQL_ROW row = mysql_fetch_row(res.get());
+								if (row == nullptr) {
+									// an error after a cancellation is that of the KILL QUERY
+									if (mysql_errno(my_conn) != 0 && !cancelled.load(std::memory_order_relaxed)) throw mysql_exception{ my_conn };
+									break;
+								}
+
+								row_type data;
+								decode(res.get(), row, num_fields, data, is_struct{});
+								event.rows++;
+								MYSQLPP_PROBE1(row__fetched, num_fields);
+
+								// back-pressure: when the ring is full, sleep until the consumer has emptied half of it
+								while (!ring.try_push(std::move(data))) {
+									if (cancelled.load(std::memory_order_relaxed)) break;
+									block(producer_waiting, [this] { return has_room(); });
+								}
+								wake(consumer_waiting);
+							}
+						}
+					});
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+
+				// a KILL QUERY being sent must reach the statement before the connection is used again
+				{
+					std::lock_guard<std::mutex> lg(cancel_mutex);
+					if (kill_token != 0) canceller->disarm(kill_token);
+					canceller.reset();
+				}
+
+				finished.store(true, std::memory_order_release);
+				wake(consumer_waiting);
+			}
+
+		public:
+			prefetch_reader(const prefetch_reader&) = delete;
+			void operator =(const prefetch_reader&) = delete;
+
+			// start executing the query; `capacity' is the maximum number of decoded rows buffered ahead
+			prefetch_reader(connection& pcon, const std::string& query_str, std::size_t capacity = 1024)
+				: con(pcon), ring(capacity)
+			{
+				worker = std::thread(&prefetch_reader::run, this, query_str);
+			}
+
+			virtual ~prefetch_reader() {
+				cancel();
+				if (worker.joinable()) worker.join();
+			}
+
+			// stop fetching, interrupting the statement if the connection has a canceller; remaining rows are discarded
+			void cancel() {
+				if (cancelled.exchange(true)) return;
+				wake(producer_waiting);
+				wake(consumer_waiting);
+
+				std::lock_guard<std::mutex> lg(cancel_mutex);
+				if (canceller) kill_token = canceller->arm(server_thread, std::chrono::steady_clock::now());
+			}
+
+			bool is_cancelled() const {
+				return cancelled.load(std::memory_order_relaxed);
+			}
+
+			// number of rows handed to the consumer so far
+			std::size_t count() const {
+				return num_rows;
+			}
+
+			// wait for the next row, return false at the end of the result or after cancellation
+			// (errors raised in the fetch thread are rethrown here)
+			bool next(row_type& data) {
+				while (!ring.try_pop(data)) {
+					if (finished.load(std::memory_order_acquire)) {
+						// the fetch thread may have pushed its last rows right before finishing
+						if (ring.try_pop(data)) break;
+
+						if (error) std::rethrow_exception(error);
+						return false;
+					}
+					if (cancelled.load(std::memory_order_relaxed)) return false;
+
+					block(consumer_waiting, [this] {
+						return !ring.empty() || finished.load(std::memory_order_acquire) || cancelled.load(std::memory_order_relaxed);
+					});
+				}
+
+				if (ring.size() <= ring.capacity() / 2) wake(producer_waiting);
+				num_rows++;
+				return true;
+			}
+
+			// get data from every fields of the next row (into the struct for a struct row)
+			bool fetch(Values&... values) {
+				return fetch_row(is_struct{}, values...);
+			}
+
+			// iterate through remaining rows, each time execute the callback function with row fields in parameter,
+			// or with the struct for a struct row (return true from the callback to continue, false to stop and cancel)
+			template <typename Function>
+			int each(Function callback) {
+				int count = 0;
+				row_type data;
+				while (next(data)) {
+					count++;
+					if (!call(callback, data, is_struct{})) {
+						cancel();
+						break;
+					}
+				}
+
+				return count;
+			}
+		};
+	}
+}
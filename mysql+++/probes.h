@@ -0,0 +1,116 @@
+#pragma once
+
+
+// USDT (SystemTap/DTrace-compatible) static tracepoints, compiled in only when MYSQLPP_USDT is defined;
+// they need <sys/sdt.h> (systemtap-sdt-dev on Debian, systemtap-sdt-devel on Red Hat) and are
+// listed with `bpftrace -l "usdt:./app:mysqlpp:*"'
+//
+// probes (provider `mysqlpp'), durations are in nanoseconds:
+//   query__start(kind, sql, sql_length)					kind: 0 query, 1 exec, 2 mquery
+//   query__done(kind, sql, error, rows, duration)
+//   stmt__prepare(stmt, sql, ok)
+//   stmt__execute__start(stmt, sql)
+//   stmt__execute__done(stmt, error, rows, duration)
+//   stmt__fetch(stmt, error, duration)						one row of a prepared statement
+//   result__fetch(rows, bytes, error, duration)			transfer of a whole result
+//   row__fetched(num_fields)								one row received by a `result' or `prefetch_reader'
+//   connection__open(conn, host, port, error)
+//   connection__close(conn)
+//
+// every probe has a semaphore that tracers increment while attached: a probe nobody is attached to
+// costs a load and a branch, and operations are only timed for probes while one is in use. The
+// semaphores need this header to be included before any other inclusion of <sys/sdt.h>, and make
+// every other probe of the same translation units use a semaphore too. Without MYSQLPP_USDT nothing
+// is compiled
+
+#ifdef MYSQLPP_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// weak, so that every translation unit may define them
+#define MYSQLPP_SEMAPHORE(name) \
+	__extension__ unsigned short mysqlpp_##name##_semaphore __attribute__((weak, unused, section(".probes")))
+
+MYSQLPP_SEMAPHORE(query__start);
+MYSQLPP_SEMAPHORE(query__done);
+MYSQLPP_SEMAPHORE(stmt__prepare);
+MYSQLPP_SEMAPHORE(stmt__execute__start);
+MYSQLPP_SEMAPHORE(stmt__execute__done);
+MYSQLPP_SEMAPHORE(stmt__fetch);
+MYSQLPP_SEMAPHORE(result__fetch);
+MYSQLPP_SEMAPHORE(row__fetched);
+MYSQLPP_SEMAPHORE(connection__open);
+MYSQLPP_SEMAPHORE(connection__close);
+
+#define MYSQLPP_PROBE_ENABLED(name) __builtin_expect(*(volatile unsigned short*)&mysqlpp_##name##_semaphore != 0, 0)
+
+#define MYSQLPP_PROBE1(name, a1) do { if (MYSQLPP_PROBE_ENABLED(name)) DTRACE_PROBE1(mysqlpp, name, a1); } while (0)
+#define MYSQLPP_PROBE2(name, a1, a2) do { if (MYSQLPP_PROBE_ENABLED(name)) DTRACE_PROBE2(mysqlpp, name, a1, a2); } while (0)
+#define MYSQLPP_PROBE3(name, a1, a2, a3) do { if (MYSQLPP_PROBE_ENABLED(name)) DTRACE_PROBE3(mysqlpp, name, a1, a2, a3); } while (0)
+#define MYSQLPP_PROBE4(name, a1, a2, a3, a4) do { if (MYSQLPP_PROBE_ENABLED(name)) DTRACE_PROBE4(mysqlpp, name, a1, a2, a3, a4); } while (0)
+#define MYSQLPP_PROBE5(name, a1, a2, a3, a4, a5) do { if (MYSQLPP_PROBE_ENABLED(name)) DTRACE_PROBE5(mysqlpp, name, a1, a2, a3, a4, a5); } while (0)
+
+#else
+
+#define MYSQLPP_PROBE_ENABLED(name) false
+
+#define MYSQLPP_PROBE1(name, a1) do {} while (0)
+#define MYSQLPP_PROBE2(name, a1, a2) do {} while (0)
+#define MYSQLPP_PROBE3(name, a1, a2, a3) do {} while (0)
+#define MYSQLPP_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+#define MYSQLPP_PROBE5(name, a1, a2, a3, a4, a5) do {} while (0)
+
+#endif
+
+
+#include "observer.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		// true while a tracer is attached to a probe fired by `observe'
+		inline bool probes_enabled() {
+			return MYSQLPP_PROBE_ENABLED(query__start) || MYSQLPP_PROBE_ENABLED(query__done) ||
+				MYSQLPP_PROBE_ENABLED(stmt__execute__start) || MYSQLPP_PROBE_ENABLED(stmt__execute__done) ||
+				MYSQLPP_PROBE_ENABLED(stmt__fetch) || MYSQLPP_PROBE_ENABLED(result__fetch);
+		}
+
+		// fire the start probe matching an operation observed by `observe'
+		inline void probe_start(const query_event& event) {
+			switch (event.kind) {
+			case query_event::query:
+			case query_event::exec:
+			case query_event::mquery:
+				MYSQLPP_PROBE3(query__start, (int)event.kind, event.sql, event.sql_length);
+				break;
+			case query_event::stmt_execute:
+				MYSQLPP_PROBE2(stmt__execute__start, event.stmt, event.sql);
+				break;
+			default:
+				break;
+			}
+		}
+
+		// fire the completion probe matching an operation observed by `observe'
+		inline void probe_end(const query_event& event) {
+			switch (event.kind) {
+			case query_event::query:
+			case query_event::exec:
+			case query_event::mquery:
+				MYSQLPP_PROBE5(query__done, (int)event.kind, event.sql, event.error, event.rows, (long long)event.duration.count());
+				break;
+			case query_event::stmt_execute:
+				MYSQLPP_PROBE4(stmt__execute__done, event.stmt, event.error, event.rows, (long long)event.duration.count());
+				break;
+			case query_event::stmt_fetch:
+				MYSQLPP_PROBE3(stmt__fetch, event.stmt, event.error, (long long)event.duration.count());
+				break;
+			case query_event::result_fetch:
+				MYSQLPP_PROBE4(result__fetch, event.rows, event.bytes, event.error, (long long)event.duration.count());
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+
+
+namespace daotk {
+	namespace mysql {
+
+		// lock-free log-linear latency histogram: every power of two is split in `sub_buckets'
+		// linear buckets, so percentiles are exact to within 1/sub_buckets (~12%)
+		class latency_histogram {
+		public:
+			static const unsigned int sub_buckets = 8;
+			static const unsigned int max_power = 42;		// ~73 minutes in nanoseconds
+			static const unsigned int num_buckets = (max_power + 2) * sub_buckets;
+
+		protected:
+			std::atomic<unsigned long long> buckets[num_buckets];
+			std::atomic<unsigned long long> num_values;
+			std::atomic<unsigned long long> total;
+			std::atomic<unsigned long long> max_value;
+
+			static unsigned int bucket_of(unsigned long long v) {
+				if (v < sub_buckets) return (unsigned int)v;
+
+				unsigned int power = 0;
+				while ((v >> power) >= 2 * sub_buckets) power++;
+				if (power > max_power) return num_buckets - 1;
+
+				// v >> power is in [sub_buckets, 2 * sub_buckets)
+				return (power + 1) * sub_buckets + (unsigned int)((v >> power) - sub_buckets);
+			}
+
+			// upper bound of the values falling into bucket `b'
+			static unsigned long long bucket_limit(unsigned int b) {
+				if (b < sub_buckets) return b;
+
+				unsigned int power = b / sub_buckets - 1;
+				return (((unsigned long long)(b % sub_buckets + sub_buckets) + 1) << power) - 1;
+			}
+
+		public:
+			latency_histogram() {
+				reset();
+			}
+
+			void record(std::chrono::nanoseconds d) {
+				unsigned long long v = d.count() > 0 ? (unsigned long long)d.count() : 0;
+
+				buckets[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+				num_values.fetch_add(1, std::memory_order_relaxed);
+				total.fetch_add(v, std::memory_order_relaxed);
+
+				unsigned long long m = max_value.load(std::memory_order_relaxed);
+				while (v > m && !max_value.compare_exchange_weak(m, v, std::memory_order_relaxed));
+			}
+
+			void reset() {
+				for (auto& b : buckets)
+					b.store(0, std::memory_order_relaxed);
+				num_values.store(0, std::memory_order_relaxed);
+				total.store(0, std::memory_order_relaxed);
+				max_value.store(0, std::memory_order_relaxed);
+			}
+
+			unsigned long long count() const {
+				return num_values.load(std::memory_order_relaxed);
+			}
+
+			std::chrono::nanoseconds sum() const {
+				return std::chrono::nanoseconds(total.load(std::memory_order_relaxed));
+			}
+
+			std::chrono::nanoseconds maximum() const {
+				return std::chrono::nanoseconds(max_value.load(std::memory_order_relaxed));
+			}
+
+			// value below which a fraction `q' (0..1) of the recorded values fall
+			std::chrono::nanoseconds percentile(double q) const {
+				unsigned long long n = count();
+				if (n == 0) return std::chrono::nanoseconds(0);
+
+				unsigned long long rank = (unsigned long long)(q * n);
+				if (rank >= n) rank = n - 1;
+
+				unsigned long long seen = 0;
+				for (unsigned int b = 0; b < num_buckets; b++) {
+					seen += buckets[b].load(std::memory_order_relaxed);
+					if (seen > rank) return std::chrono::nanoseconds((std::min)(bucket_limit(b), max_value.load(std::memory_order_relaxed)));
+				}
+				return maximum();
+			}
+		};
+
+
+		// phases of a statement, as timed by `query_profiler'
+		enum class query_phase {
+			format,			// printf-style formatting of the statement text
+			send,			// writing the statement to the server
+			server_wait,	// waiting for the server's first reply (execution; execute of prepared statements)
+			transfer,		// receiving the result rows (mysql_store_result, fetch of prepared statements)
+			decode,			// copying the rows into the `result' object
+			convert			// converting field data to C++ values (get_value, fetch, iterators)
+		};
+
+		static const unsigned int num_query_phases = 6;
+
+		inline const char* query_phase_name(query_phase phase) {
+			static const char* names[num_query_phases] = { "format", "send", "server_wait", "transfer", "decode", "convert" };
+			return names[(unsigned int)phase];
+		}
+
+
+		struct statement_profile {
+			latency_histogram phases[num_query_phases];
+
+			void record(query_phase phase, std::chrono::nanoseconds d) {
+				phases[(unsigned int)phase].record(d);
+			}
+
+			const latency_histogram& operator [](query_phase phase) const {
+				return phases[(unsigned int)phase];
+			}
+		};
+
+
+		// opt-in profiler: attached to connections with `connection::set_profiler', it timestamps every
+		// phase of each statement with a monotonic clock and aggregates them per statement
+		//
+		// statements are keyed by their text, or by `key_function' if set (e.g. to strip literals);
+		// beyond `max_statements' distinct keys, statements are aggregated under "(other)"
+		class query_profiler {
+		protected:
+			mutable std::mutex mutex;
+			std::unordered_map<std::string, std::unique_ptr<statement_profile>> profiles;
+			std::size_t max_statements;
+
+		public:
+			std::function<std::string(const char* sql, std::size_t sql_length)> key_function;
+
+			query_profiler(const query_profiler&) = delete;
+			void operator =(const query_profiler&) = delete;
+
+			query_profiler(std::size_t _max_statements = 1000)
+				: max_statements(_max_statements)
+			{}
+
+			// profile of a statement, created on first use; the reference stays valid as long as the profiler
+			statement_profile& profile(const char* sql, std::size_t sql_length) {
+				std::string key = key_function ? key_function(sql, sql_length) : std::string(sql, sql_length);
+
+				std::lock_guard<std::mutex> lg(mutex);
+				auto itr = profiles.find(key);
+				if (itr != profiles.end()) return *itr->second;
+
+				if (profiles.size() >= max_statements) key = "(other)";
+
+				auto& p = profiles[key];
+				if (!p) p.reset(new statement_profile());
+				return *p;
+			}
+
+			statement_profile& profile(const std::string& sql) {
+				return profile(sql.c_str(), sql.length());
+			}
+
+			// clear all histograms (the statements stay known, so references remain valid)
+			void reset() {
+				std::lock_guard<std::mutex> lg(mutex);
+				for (auto& p : profiles)
+					for (auto& h : p.second->phases)
+						h.reset();
+			}
+
+			// text report: one line per statement and phase with count, p50, p99 and max in microseconds
+			std::string report() const {
+				std::lock_guard<std::mutex> lg(mutex);
+
+				std::vector<const std::pair<const std::string, std::unique_ptr<statement_profile>>*> sorted;
+				for (auto& p : profiles)
+					sorted.push_back(&p);
+				std::sort(sorted.begin(), sorted.end(), [](decltype(sorted[0]) a, decltype(sorted[0]) b) {
+					return a->first < b->first;
+				});
+
+				std::string res;
+				char line[160];
+				for (auto p : sorted) {
+					res += p->first;
+					res += '\n';
+
+					for (unsigned int i = 0; i < num_query_phases; i++) {
+						const latency_histogram& h = p->second->phases[i];
+						if (h.count() == 0) continue;
+
+						std::snprintf(line, sizeof(line), "  %-12s count=%llu p50=%.1fus p99=%.1fus max=%.1fus\n",
+							query_phase_name((query_phase)i), h.count(),
+							h.percentile(0.5).count() / 1000.0, h.percentile(0.99).count() / 1000.0, h.maximum().count() / 1000.0);
+						res += line;
+					}
+				}
+
+				return res;
+			}
+		};
+	}
+}
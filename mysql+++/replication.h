@@ -0,0 +1,434 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mysql+++.h"
+#include "pool.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		struct replication_options {
+			pool_options pool;										// for the primary's and every replica's pool
+			std::chrono::milliseconds max_lag{ 1000 };				// replicas lagging more are not read from
+			std::chrono::milliseconds check_interval{ 1000 };		// how often the lag of replicas is measured
+
+			// query returning the replica's lag in seconds, NULL if it is not replicating. The default (MySQL 8.0)
+			// is NULL while the receiver or an applier is stopped, and otherwise the age of the oldest
+			// transaction being applied, 0 when idle; it cannot see transactions not received yet. A heartbeat
+			// table written on the primary every second (pt-heartbeat) measures lag end to end, e.g.
+			// "select timestampdiff(microsecond, max(ts), utc_timestamp(6)) / 1000000 from percona.heartbeat"
+			std::string lag_query =
+				"select if(min(w.SERVICE_STATE = 'ON' and c.SERVICE_STATE = 'ON'), "
+				"max(if(w.APPLYING_TRANSACTION = '', 0, timestampdiff(microsecond, w.APPLYING_TRANSACTION_ORIGINAL_COMMIT_TIMESTAMP, now(6)))) / 1000000, null) "
+				"from performance_schema.replication_applier_status_by_worker w "
+				"join performance_schema.replication_connection_status c using (CHANNEL_NAME)";
+
+			// read-your-writes in sessions: after a write, a session reads from a replica only once the
+			// replica has executed the GTIDs of the session's writes (checked with GTID_SUBSET), from the
+			// primary otherwise, and always from the primary if the primary does not use GTIDs
+			bool read_your_writes = true;
+			std::chrono::milliseconds sticky_window{ 0 };			// reads also stay on the primary for this long after a write
+		};
+
+
+		// read/write splitting over one primary and its replicas: writes go to the primary, reads to a
+		// replica whose lag is under `max_lag', round-robin; reads fall back to the primary when no replica
+		// qualifies. Sessions add read-your-writes stickiness and transactions pinned to the primary
+		class rw_router {
+		public:
+			using clock = std::chrono::steady_clock;
+			static const std::size_t npos = (std::size_t)-1;
+
+			struct replica_status {
+				bool available;								// reachable and replicating at the last check
+				std::chrono::microseconds lag;
+				clock::time_point checked;
+			};
+
+			class session;
+
+		protected:
+			struct replica {
+				connect_options options;
+				std::unique_ptr<connection_pool> pool;
+				std::unique_ptr<connection> monitor;		// dedicated to lag checks, so they never wait for the pool
+
+				std::atomic<bool> available{ false };
+				std::atomic<long long> lag_us{ 0 };
+				std::atomic<long long> checked_ns{ 0 };		// clock::time_point of the last check, since the epoch
+			};
+
+			replication_options ropts;
+			connection_pool primary_pool;
+			std::vector<std::unique_ptr<replica>> replicas;
+			std::atomic<std::size_t> next_replica{ 0 };
+
+			metric_counter* primary_reads = nullptr;
+			metric_counter* replica_reads = nullptr;
+
+			std::mutex monitor_mutex;
+			std::condition_variable monitor_cv;
+			bool stopping = false;
+			std::thread monitor;
+
+
+			static long long ticks(clock::time_point t) {
+				return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+			}
+
+			// the primary reports the GTID of each transaction in its reply, for read-your-writes (MySQL 5.7.6+)
+			static connect_options primary_options(const connect_options& primary, const replication_options& opts) {
+				connect_options res = primary;
+				if (opts.read_your_writes) res.init_commands.push_back("set session session_track_gtids = OWN_GTID");
+				return res;
+			}
+
+			void check(replica& r) {
+				try {
+					if (!r.monitor || !r.monitor->is_open()) {
+						r.monitor.reset(new connection());
+						if (!r.monitor->open(r.options)) throw std::runtime_error(r.monitor->error_message());
+					}
+
+					optional<double> lag;
+					result res = r.monitor->query(ropts.lag_query);
+					if (!res.fetch(lag) || !lag) throw std::runtime_error("Replica is not replicating");
+
+					r.lag_us.store((long long)(*lag * 1e6), std::memory_order_relaxed);
+					r.available.store(true, std::memory_order_relaxed);
+				}
+				catch (...) {
+					r.monitor.reset();
+					r.available.store(false, std::memory_order_relaxed);
+				}
+
+				r.checked_ns.store(ticks(clock::now()), std::memory_order_release);
+			}
+
+			void run_monitor() {
+				thread_init_guard tg;
+				std::unique_lock<std::mutex> lk(monitor_mutex);
+
+				while (!stopping) {
+					lk.unlock();
+					for (auto& r : replicas)
+						check(*r);
+					lk.lock();
+
+					monitor_cv.wait_for(lk, ropts.check_interval, [this] { return stopping; });
+				}
+			}
+
+			bool qualifies(const replica& r) const {
+				long long max_lag_us = (long long)std::chrono::duration_cast<std::chrono::microseconds>(ropts.max_lag).count();
+				return r.available.load(std::memory_order_relaxed) && r.lag_us.load(std::memory_order_relaxed) <= max_lag_us;
+			}
+
+			// index of a replica fit for a read, other than `exclude'; npos if none
+			std::size_t pick_replica(std::size_t exclude = npos) {
+				std::size_t n = replicas.size();
+				std::size_t start = next_replica.fetch_add(1, std::memory_order_relaxed);
+				for (std::size_t i = 0; i < n; i++) {
+					std::size_t k = (start + i) % n;
+					if (k != exclude && qualifies(*replicas[k])) return k;
+				}
+				return npos;
+			}
+
+			// whether `con' (on a replica) has executed every transaction of the GTID set `gtids'
+			static bool has_executed(connection& con, const std::string& gtids) {
+				result res = con.query("select gtid_subset('%s', @@global.gtid_executed)", con.escape_string(gtids).c_str());
+				int executed = 0;
+				return res.fetch(executed) && executed == 1;
+			}
+
+			// read connection on a replica that has executed `gtids' (any replica if empty), on the primary
+			// if none qualifies; `caught_up' remembers the replica found for the same `gtids'
+			pooled_connection acquire_read(const std::string& gtids = "", std::size_t* caught_up = nullptr) {
+				// the replica known to be caught up first, then the others in round-robin
+				std::size_t n = replicas.size();
+				std::size_t known = (caught_up != nullptr) ? *caught_up : npos;
+				std::size_t start = next_replica.fetch_add(1, std::memory_order_relaxed);
+				for (std::size_t i = 0; n > 0 && i <= n; i++) {
+					std::size_t k = (i == 0) ? known : (start + i) % n;
+					if (k == npos || (i > 0 && k == known) || !qualifies(*replicas[k])) continue;
+
+					try {
+						pooled_connection pc = replicas[k]->pool->acquire();
+						if (!gtids.empty() && (caught_up == nullptr || *caught_up != k)) {
+							if (!has_executed(*pc, gtids)) continue;
+							if (caught_up != nullptr) *caught_up = k;
+						}
+
+						if (replica_reads != nullptr) replica_reads->add();
+						return pc;
+					}
+					catch (...) {
+						// unreachable or saturated replica: try another one
+					}
+				}
+
+				if (primary_reads != nullptr) primary_reads->add();
+				return primary_pool.acquire();
+			}
+
+			static result fetch_query(pooled_connection& pc, const std::string& query_str) {
+				result res = pc->query(query_str);
+				res.count();
+				return res;
+			}
+
+		public:
+			rw_router(const rw_router&) = delete;
+			void operator =(const rw_router&) = delete;
+
+			rw_router(const connect_options& primary, const std::vector<connect_options>& replica_list, const replication_options& opts = replication_options())
+				: ropts(opts), primary_pool(primary_options(primary, opts), [&] { pool_options po = opts.pool; po.name += "_primary"; return po; }())
+			{
+				for (std::size_t i = 0; i < replica_list.size(); i++) {
+					pool_options po = opts.pool;
+					po.name += "_replica" + std::to_string(i);
+
+					std::unique_ptr<replica> r(new replica());
+					r->options = replica_list[i];
+					r->pool.reset(new connection_pool(replica_list[i], po));
+					replicas.push_back(std::move(r));
+				}
+
+				if (opts.pool.metrics != nullptr) {
+					primary_reads = &opts.pool.metrics->counter("rw_reads_total", "Reads by target of the read/write router.", "target=\"primary\"");
+					replica_reads = &opts.pool.metrics->counter("rw_reads_total", "Reads by target of the read/write router.", "target=\"replica\"");
+				}
+
+				// measure once before serving, so that reads can go to replicas right away
+				for (auto& r : replicas)
+					check(*r);
+				if (!replicas.empty()) monitor = std::thread(&rw_router::run_monitor, this);
+			}
+
+			virtual ~rw_router() {
+				if (monitor.joinable()) {
+					{
+						std::lock_guard<std::mutex> lg(monitor_mutex);
+						stopping = true;
+					}
+					monitor_cv.notify_one();
+					monitor.join();
+				}
+			}
+
+			// read from a replica if one qualifies (no read-your-writes guarantee, see `session')
+			result query(const std::string& query_str) {
+				pooled_connection pc = acquire_read();
+				return fetch_query(pc, query_str);
+			}
+
+			template <typename... Values>
+			result query(const std::string& fmt_str, Values... values) {
+				return query(format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			// write to the primary and return the number of affected rows
+			unsigned long long exec(const std::string& query_str) {
+				pooled_connection pc = primary_pool.acquire();
+				pc->exec(query_str);
+				return pc->affected_rows();
+			}
+
+			template <typename... Values>
+			unsigned long long exec(const std::string& fmt_str, Values... values) {
+				return exec(format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			pooled_connection acquire_primary() {
+				return primary_pool.acquire();
+			}
+
+			// connection for reads that must see the transactions of the GTID set `gtids' (empty for any):
+			// on a replica that has executed them, on the primary if none has
+			pooled_connection acquire_replica(const std::string& gtids = "") {
+				return acquire_read(gtids);
+			}
+
+			std::size_t replica_count() const {
+				return replicas.size();
+			}
+
+			// index of a replica fit for a read, other than `exclude'; npos if none
+			std::size_t select_replica(std::size_t exclude = npos) {
+				return pick_replica(exclude);
+			}
+
+			connection_pool& replica_pool(std::size_t i) {
+				return *replicas.at(i)->pool;
+			}
+
+			replica_status status(std::size_t i) const {
+				const replica& r = *replicas.at(i);
+
+				replica_status res;
+				res.available = r.available.load(std::memory_order_relaxed);
+				res.lag = std::chrono::microseconds(r.lag_us.load(std::memory_order_relaxed));
+				res.checked = clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(r.checked_ns.load(std::memory_order_acquire))));
+				return res;
+			}
+
+			session open_session();
+		};
+
+
+		// unit of consistency of a `rw_router', typically one per user request or per client: reads after
+		// a write of the same session see that write (if `read_your_writes'), and a transaction runs entirely
+		// on the primary; not thread-safe
+		class rw_router::session {
+		protected:
+			rw_router& router;
+			clock::time_point last_write;
+			pooled_connection pinned;		// held on the primary during a transaction
+
+			std::string gtids;						// of the session's writes, empty if the primary does not use GTIDs
+			std::size_t caught_up = npos;			// replica known to have executed `gtids'
+
+			// GTID of the last transaction of `con', reported in the reply to its last statement (the commit)
+			// since the router sets session_track_gtids = OWN_GTID
+			static std::string own_gtid(connection& con) {
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 50704
+				const char* data = nullptr;
+				std::size_t len = 0;
+				if (mysql_session_track_get_first(con.get_raw_connection(), SESSION_TRACK_GTIDS, &data, &len) == 0 && data != nullptr)
+					return std::string(data, len);
+#endif
+				(void)con;
+				return std::string();
+			}
+
+			// record a write made on `con' (on the primary)
+			void wrote(connection& con) {
+				last_write = clock::now();
+				caught_up = npos;
+				if (!router.ropts.read_your_writes) return;
+
+				// without session tracking, all transactions executed by the primary so far
+				std::string own = own_gtid(con);
+				if (!own.empty() && gtids.length() + own.length() < 4096) {
+					if (!gtids.empty()) gtids += ',';
+					gtids += own;
+				}
+				else {
+					gtids.clear();
+					result res = con.query("select @@global.gtid_executed");
+					res.fetch(gtids);
+				}
+			}
+
+			pooled_connection acquire_read() {
+				if (!router.ropts.read_your_writes || last_write == clock::time_point())
+					return router.acquire_read();
+
+				// without GTIDs, nothing tells when a replica has the write
+				if (gtids.empty() || clock::now() - last_write < router.ropts.sticky_window) {
+					if (router.primary_reads != nullptr) router.primary_reads->add();
+					return router.primary_pool.acquire();
+				}
+
+				return router.acquire_read(gtids, &caught_up);
+			}
+
+		public:
+			session(rw_router& _router)
+				: router(_router)
+			{}
+
+			session(session&&) = default;
+
+			virtual ~session() {
+				if (pinned) {
+					try {
+						rollback();
+					}
+					catch (...) {}
+				}
+			}
+
+			result query(const std::string& query_str) {
+				if (pinned) return fetch_query(pinned, query_str);
+
+				pooled_connection pc = acquire_read();
+				return fetch_query(pc, query_str);
+			}
+
+			template <typename... Values>
+			result query(const std::string& fmt_str, Values... values) {
+				return query(format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			unsigned long long exec(const std::string& query_str) {
+				if (pinned) {
+					pinned->exec(query_str);
+					return pinned->affected_rows();
+				}
+
+				pooled_connection pc = router.primary_pool.acquire();
+				pc->exec(query_str);
+				unsigned long long res = pc->affected_rows();
+				wrote(*pc);
+				return res;
+			}
+
+			template <typename... Values>
+			unsigned long long exec(const std::string& fmt_str, Values... values) {
+				return exec(format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			// start a transaction on the primary; reads and writes go through it until commit or rollback
+			void begin() {
+				if (pinned) throw std::logic_error("Transaction already started");
+
+				pinned = router.primary_pool.acquire();
+				pinned->set_autocommit(false);
+			}
+
+			void commit() {
+				if (!pinned) throw std::logic_error("No transaction");
+
+				// the GTID is tracked in the reply to COMMIT, the next statement would replace it
+				pinned->commit();
+				wrote(*pinned);
+				pinned->set_autocommit(true);
+				pinned.release();
+			}
+
+			void rollback() {
+				if (!pinned) throw std::logic_error("No transaction");
+
+				pinned->rollback();
+				pinned->set_autocommit(true);
+				pinned.release();
+			}
+
+			bool in_transaction() const {
+				return (bool)pinned;
+			}
+
+			// time of the last write, clock::time_point() if none
+			clock::time_point last_write_time() const {
+				return last_write;
+			}
+		};
+
+
+		inline rw_router::session rw_router::open_session() {
+			return session(*this);
+		}
+	}
+}
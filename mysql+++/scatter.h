@@ -0,0 +1,211 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <tuple>
+#include <queue>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "mysql+++.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		struct scatter_options {
+			std::chrono::milliseconds timeout{ 0 };	// per shard, see `deadline'; 0 for none
+			unsigned int parallelism = 0;				// number of threads, 0 for one per shard
+		};
+
+
+		// outcome of the work done on one shard
+		template <typename Value>
+		struct shard_outcome {
+			std::size_t shard = 0;						// index of the connection in the list given to `scatter'
+			Value value{};
+			std::exception_ptr error;					// set if the shard failed, the others are not affected
+			bool timed_out = false;						// the shard did not answer within `scatter_options::timeout'
+			std::chrono::microseconds elapsed{ 0 };
+
+			bool ok() const {
+				return !error;
+			}
+		};
+
+		using shard_result = shard_outcome<result>;
+
+
+		namespace scatter_detail {
+			template <typename Connections, typename Function, typename Value>
+			void run(const Connections& shards, Function& fn, std::vector<shard_outcome<Value>>& res, unsigned int parallelism) {
+				std::size_t count = res.size();
+				std::size_t num_threads = parallelism > 0 ? (std::min)((std::size_t)parallelism, count) : count;
+				std::atomic<std::size_t> next{ 0 };
+
+				auto work = [&]() {
+					for (std::size_t i; (i = next++) < count; ) {
+						auto t0 = std::chrono::steady_clock::now();
+						res[i].shard = i;
+
+						try {
+							res[i].value = fn(*shards[i], i);
+						}
+						catch (mysqlpp_exception& exp) {
+							res[i].timed_out = (exp.code() == mysqlpp_exception::query_timeout);
+							res[i].error = std::current_exception();
+						}
+						catch (...) {
+							res[i].error = std::current_exception();
+						}
+
+						res[i].elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0);
+					}
+				};
+
+				// the calling thread takes its share too
+				std::vector<std::thread> threads;
+				for (std::size_t i = 1; i < num_threads; i++)
+					threads.emplace_back([&] {
+						thread_init_guard tg;
+						work();
+					});
+				work();
+
+				for (auto& t : threads)
+					t.join();
+			}
+
+			template <typename... Values, std::size_t... I>
+			bool fetch_row(result& res, std::tuple<Values...>& row, std::index_sequence<I...>) {
+				return res.fetch(std::get<I>(row)...);
+			}
+		}
+
+
+		// run `fn(connection&, shard index)' on every connection concurrently and collect what it returns;
+		// `shards' is any indexable container of pointers to connections (raw or smart)
+		template <typename Connections, typename Function>
+		auto scatter_call(const Connections& shards, Function fn, const scatter_options& options = scatter_options())
+			-> std::vector<shard_outcome<decltype(fn(*shards[0], std::size_t(0)))>>
+		{
+			std::vector<shard_outcome<decltype(fn(*shards[0], std::size_t(0)))>> res(shards.size());
+			if (!res.empty()) scatter_detail::run(shards, fn, res, options.parallelism);
+			return res;
+		}
+
+		// run the same query on every connection concurrently; each result is completely fetched and,
+		// with a timeout, the query runs under a `deadline' (attach a `query_canceller' to the connections
+		// to interrupt statements still running on the server)
+		template <typename Connections>
+		std::vector<shard_result> scatter(const Connections& shards, const std::string& query_str, const scatter_options& options = scatter_options()) {
+			return scatter_call(shards, [&](connection& con, std::size_t) {
+				if (options.timeout.count() > 0)
+					return con.query(deadline(options.timeout), query_str);
+
+				result res = con.query(query_str);
+				res.count();
+				return res;
+			}, options);
+		}
+
+
+		// true if every shard succeeded
+		template <typename Value>
+		bool all_ok(const std::vector<shard_outcome<Value>>& outcomes) {
+			return std::all_of(outcomes.begin(), outcomes.end(), [](const shard_outcome<Value>& o) { return o.ok(); });
+		}
+
+		// indexes of the shards that failed
+		template <typename Value>
+		std::vector<std::size_t> failed_shards(const std::vector<shard_outcome<Value>>& outcomes) {
+			std::vector<std::size_t> res;
+			for (auto& o : outcomes)
+				if (!o.ok()) res.push_back(o.shard);
+			return res;
+		}
+
+
+		// rows of all successful shards, one shard after the other
+		template <typename... Values>
+		std::vector<std::tuple<Values...>> gather(std::vector<shard_result>& results) {
+			std::vector<std::tuple<Values...>> res;
+
+			for (auto& r : results) {
+				if (!r.ok()) continue;
+
+				// a fresh tuple per row: fetching leaves NULL fields unchanged
+				for (r.value.reset(); ; r.value.next()) {
+					std::tuple<Values...> row;
+					if (!scatter_detail::fetch_row(r.value, row, std::index_sequence_for<Values...>{})) break;
+					res.push_back(std::move(row));
+				}
+			}
+
+			return res;
+		}
+
+
+		// compare rows on their `I'-th column, for `merge_sorted'
+		template <std::size_t I>
+		struct by_column {
+			template <typename Tuple>
+			bool operator ()(const Tuple& a, const Tuple& b) const {
+				return std::get<I>(a) < std::get<I>(b);
+			}
+		};
+
+		// k-way merge of the rows of all successful shards, each already sorted by `less' (ORDER BY on
+		// the server); stops after `limit' rows if not 0, so `ORDER BY ... LIMIT n' on every shard then
+		// `merge_sorted(..., n)' gives the global top n
+		template <typename... Values, typename Less = by_column<0>>
+		std::vector<std::tuple<Values...>> merge_sorted(std::vector<shard_result>& results, Less less = Less(), std::size_t limit = 0) {
+			using row_type = std::tuple<Values...>;
+
+			struct cursor {
+				result* res;
+				row_type row;
+			};
+
+			std::vector<cursor> cursors;
+			cursors.reserve(results.size());
+			for (auto& r : results) {
+				if (!r.ok()) continue;
+
+				r.value.reset();
+				cursor c{ &r.value, row_type() };
+				if (scatter_detail::fetch_row(r.value, c.row, std::index_sequence_for<Values...>{}))
+					cursors.push_back(std::move(c));
+			}
+
+			// min-heap of cursor indexes on their current row
+			auto greater = [&](std::size_t a, std::size_t b) {
+				return less(cursors[b].row, cursors[a].row);
+			};
+			std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> heap(greater);
+			for (std::size_t i = 0; i < cursors.size(); i++)
+				heap.push(i);
+
+			std::vector<row_type> res;
+			while (!heap.empty() && (limit == 0 || res.size() < limit)) {
+				std::size_t i = heap.top();
+				heap.pop();
+
+				cursor& c = cursors[i];
+				res.push_back(std::move(c.row));
+
+				// a fresh tuple, as fetching leaves NULL fields unchanged (here, moved from)
+				c.row = row_type();
+				c.res->next();
+				if (scatter_detail::fetch_row(*c.res, c.row, std::index_sequence_for<Values...>{}))
+					heap.push(i);
+			}
+
+			return res;
+		}
+	}
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+
+#include <atomic>
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "mysql+++.h"
+#include "lockfree.h"
+#include "pool.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		// 64-bit hash of a key: std::hash, mixed so that small or sequential keys spread evenly
+		// (std::hash of an integer is often the integer itself)
+		template <typename Key>
+		std::uint64_t shard_hash(const Key& key) {
+			std::uint64_t h = (std::uint64_t)std::hash<Key>()(key);
+
+			// splitmix64 finalizer
+			h ^= h >> 30;
+			h *= 0xbf58476d1ce4e5b9ULL;
+			h ^= h >> 27;
+			h *= 0x94d049bb133111ebULL;
+			h ^= h >> 31;
+			return h;
+		}
+
+
+		// key -> shard by hash modulo the number of shards; moving to a different number of shards moves most keys
+		template <typename Key>
+		class modulo_sharding {
+		protected:
+			std::size_t num_shards;
+			std::function<std::uint64_t(const Key&)> hash;
+
+		public:
+			modulo_sharding(std::size_t _num_shards, std::function<std::uint64_t(const Key&)> _hash = shard_hash<Key>)
+				: num_shards(_num_shards), hash(std::move(_hash))
+			{
+				if (num_shards == 0) throw std::invalid_argument("No shard");
+			}
+
+			std::size_t operator ()(const Key& key) const {
+				return (std::size_t)(hash(key) % num_shards);
+			}
+		};
+
+
+		// key -> shard on a consistent hash ring with `replicas' virtual nodes per shard;
+		// adding a shard only moves the keys it takes over
+		template <typename Key>
+		class consistent_hash_ring {
+		protected:
+			std::vector<std::pair<std::uint64_t, std::size_t>> ring;		// sorted by position
+			std::function<std::uint64_t(const Key&)> hash;
+
+		public:
+			consistent_hash_ring(std::size_t num_shards, unsigned int replicas = 160, std::function<std::uint64_t(const Key&)> _hash = shard_hash<Key>)
+				: hash(std::move(_hash))
+			{
+				if (num_shards == 0 || replicas == 0) throw std::invalid_argument("No shard");
+
+				ring.reserve(num_shards * replicas);
+				for (std::size_t s = 0; s < num_shards; s++)
+					for (unsigned int r = 0; r < replicas; r++)
+						ring.emplace_back(shard_hash<std::string>(std::to_string(s) + "#" + std::to_string(r)), s);
+				std::sort(ring.begin(), ring.end());
+			}
+
+			std::size_t operator ()(const Key& key) const {
+				auto itr = std::lower_bound(ring.begin(), ring.end(), std::make_pair(hash(key), (std::size_t)0));
+				if (itr == ring.end()) itr = ring.begin();
+				return itr->second;
+			}
+		};
+
+
+		// key -> shard by ranges of keys: `add_range(k, s)' sends keys up to `k' (inclusive, down to the
+		// previous bound) to shard `s'; keys above the last bound go to `last_shard'
+		template <typename Key>
+		class range_sharding {
+		protected:
+			std::map<Key, std::size_t> bounds;
+			std::size_t last_shard;
+
+		public:
+			range_sharding(std::size_t _last_shard = 0)
+				: last_shard(_last_shard)
+			{}
+
+			range_sharding& add_range(const Key& upper_bound, std::size_t shard) {
+				bounds[upper_bound] = shard;
+				return *this;
+			}
+
+			std::size_t operator ()(const Key& key) const {
+				auto itr = bounds.lower_bound(key);
+				return itr == bounds.end() ? last_shard : itr->second;
+			}
+		};
+
+
+		// routes statements to the shard owning a key, each shard with its own pool of connections
+		//
+		// the shard list and the key mapping are fixed at construction, so routing takes no lock;
+		// the only locks taken are those of the pool of the shard being used
+		template <typename Key = std::string>
+		class shard_router {
+		public:
+			struct shard_statistics {
+				unsigned long long requests;
+				unsigned long long errors;
+				connection_pool::statistics pool;
+			};
+
+		protected:
+			// per-shard counters, padded so that shards used by different threads do not share cache lines
+			struct shard_counters {
+				std::atomic<unsigned long long> requests{ 0 };
+				std::atomic<unsigned long long> errors{ 0 };
+				char padding[cache_line_size];
+			};
+
+			std::vector<std::unique_ptr<connection_pool>> pools;
+			std::unique_ptr<shard_counters[]> counters;
+			std::function<std::size_t(const Key&)> locate;
+
+		public:
+			shard_router(const shard_router&) = delete;
+			void operator =(const shard_router&) = delete;
+
+			// `strategy' maps a key to an index in `shards', e.g. `modulo_sharding<Key>(shards.size())';
+			// the pools are named after the shard index for their metrics
+			shard_router(const std::vector<connect_options>& shards, std::function<std::size_t(const Key&)> strategy, const pool_options& popts = pool_options())
+				: counters(new shard_counters[shards.size()]), locate(std::move(strategy))
+			{
+				for (std::size_t i = 0; i < shards.size(); i++) {
+					pool_options po = popts;
+					po.name = popts.name + "_shard" + std::to_string(i);
+					pools.emplace_back(new connection_pool(shards[i], po));
+				}
+			}
+
+			std::size_t size() const {
+				return pools.size();
+			}
+
+			std::size_t shard_of(const Key& key) const {
+				std::size_t s = locate(key);
+				if (s >= pools.size()) throw std::out_of_range("Key mapped to an unknown shard");
+				return s;
+			}
+
+			connection_pool& pool(std::size_t shard) {
+				return *pools.at(shard);
+			}
+
+			// borrow a connection to the shard owning `key'
+			pooled_connection acquire(const Key& key) {
+				return pools[shard_of(key)]->acquire();
+			}
+
+			// run `fn(pooled_connection&)' on the shard owning `key' and return its result,
+			// counting the request and its failure in the shard's statistics
+			template <typename Function>
+			auto with_shard(const Key& key, Function fn) -> decltype(fn(std::declval<pooled_connection&>())) {
+				std::size_t s = shard_of(key);
+				counters[s].requests.fetch_add(1, std::memory_order_relaxed);
+
+				try {
+					pooled_connection pc = pools[s]->acquire();
+					return fn(pc);
+				}
+				catch (...) {
+					counters[s].errors.fetch_add(1, std::memory_order_relaxed);
+					throw;
+				}
+			}
+
+			// run a query on the shard owning `key'; the result is fetched before the connection is given back
+			result query(const Key& key, const std::string& query_str) {
+				return with_shard(key, [&](pooled_connection& pc) {
+					result res = pc->query(query_str);
+					res.count();
+					return res;
+				});
+			}
+
+			template <typename... Values>
+			result query(const Key& key, const std::string& fmt_str, Values... values) {
+				return query(key, format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			// run a statement on the shard owning `key' and return the number of affected rows
+			unsigned long long exec(const Key& key, const std::string& query_str) {
+				return with_shard(key, [&](pooled_connection& pc) {
+					pc->exec(query_str);
+					return pc->affected_rows();
+				});
+			}
+
+			template <typename... Values>
+			unsigned long long exec(const Key& key, const std::string& fmt_str, Values... values) {
+				return exec(key, format_string(fmt_str.c_str(), std::forward<Values>(values)...));
+			}
+
+			// execute a prepared statement (prepared once per pooled connection) on the shard owning `key'
+			// and return the number of affected rows
+			template <typename... Values>
+			unsigned long long execute(const Key& key, const std::string& sql, const Values&... values) {
+				return with_shard(key, [&](pooled_connection& pc) {
+					prepared_stmt& st = pc.prepare(sql);
+					st.bind_param(values...);
+					if (!st.execute())
+						throw std::runtime_error(std::string("Failed to execute stmt: ") + st.error_message());
+					return st.affected_rows();
+				});
+			}
+
+			shard_statistics stats(std::size_t shard) {
+				shard_statistics res;
+				res.requests = counters[shard].requests.load(std::memory_order_relaxed);
+				res.errors = counters[shard].errors.load(std::memory_order_relaxed);
+				res.pool = pools.at(shard)->stats();
+				return res;
+			}
+		};
+	}
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <stdexcept>
+
+#include "mysql+++.h"
+#include "lockfree.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		// rows of a snapshot, as ids into its columns
+		struct row_range {
+			const std::uint32_t* first = nullptr;
+			const std::uint32_t* last = nullptr;
+
+			const std::uint32_t* begin() const {
+				return first;
+			}
+
+			const std::uint32_t* end() const {
+				return last;
+			}
+
+			std::size_t size() const {
+				return last - first;
+			}
+
+			bool empty() const {
+				return first == last;
+			}
+		};
+
+
+		// in-memory copy of a table (or of any query), refreshed as a whole and read without locks
+		//
+		// every refresh builds a new immutable `version': the rows in a struct-of-arrays layout (one
+		// vector per column, so scanning a column reads contiguous memory) with the requested hash and
+		// sorted indexes; it then replaces the current version with a pointer swap (`published_ptr', whose
+		// readers take no lock and never wait). Readers keep the version they obtained from `current()'
+		// for as long as they need, unaffected by refreshes
+		template <typename... Values>
+		class table_snapshot {
+		public:
+			static const std::size_t npos = (std::size_t)-1;
+
+			template <std::size_t I>
+			using column_type = typename std::tuple_element<I, std::tuple<Values...>>::type;
+
+			class version {
+				friend class table_snapshot;
+
+			protected:
+				struct column_index {
+					std::vector<std::uint32_t> hash_slots;		// open addressing, row id + 1, 0 for an empty slot
+					std::vector<std::uint32_t> sorted;			// row ids ordered by the column
+					bool has_sorted = false;
+				};
+
+				std::tuple<std::vector<Values>...> columns;
+				std::size_t num_rows = 0;
+				column_index indexes[sizeof...(Values)];
+				std::chrono::system_clock::time_point loaded_at;
+				unsigned long long number = 0;
+
+
+				template <typename Value>
+				static std::size_t hash_of(const Value& value) {
+					// std::hash of an integer is often the integer itself: mix it (splitmix64 finalizer)
+					std::uint64_t h = (std::uint64_t)std::hash<Value>()(value);
+					h ^= h >> 30;
+					h *= 0xbf58476d1ce4e5b9ULL;
+					h ^= h >> 27;
+					h *= 0x94d049bb133111ebULL;
+					h ^= h >> 31;
+					return (std::size_t)h;
+				}
+
+				template <std::size_t I>
+				void build_hash_index() {
+					auto& col = std::get<I>(columns);
+					auto& slots = indexes[I].hash_slots;
+
+					std::size_t capacity = 16;
+					while (capacity < 2 * num_rows) capacity *= 2;
+					slots.assign(capacity, 0);
+
+					std::size_t mask = capacity - 1;
+					for (std::size_t r = 0; r < num_rows; r++) {
+						std::size_t h = hash_of(col[r]) & mask;
+						while (slots[h] != 0) h = (h + 1) & mask;
+						slots[h] = (std::uint32_t)(r + 1);
+					}
+				}
+
+				template <std::size_t I>
+				void build_sorted_index() {
+					auto& col = std::get<I>(columns);
+					auto& sorted = indexes[I].sorted;
+
+					sorted.resize(num_rows);
+					for (std::size_t r = 0; r < num_rows; r++)
+						sorted[r] = (std::uint32_t)r;
+					std::stable_sort(sorted.begin(), sorted.end(), [&](std::uint32_t a, std::uint32_t b) { return col[a] < col[b]; });
+					indexes[I].has_sorted = true;
+				}
+
+				template <std::size_t I>
+				const std::vector<std::uint32_t>& hash_slots() const {
+					if (indexes[I].hash_slots.empty()) throw std::logic_error("No hash index on this column");
+					return indexes[I].hash_slots;
+				}
+
+				template <std::size_t I>
+				const std::vector<std::uint32_t>& sorted_ids() const {
+					if (!indexes[I].has_sorted) throw std::logic_error("No sorted index on this column");
+					return indexes[I].sorted;
+				}
+
+				template <std::size_t... I>
+				void append_row(result& res, std::index_sequence<I...>) {
+					int dummy[] = { 0, (append_field<I>(res), 0)... };
+					(void)dummy;
+				}
+
+				template <std::size_t I>
+				void append_field(result& res) {
+					column_type<I> value{};
+					res.get_value((int)I, value);
+					std::get<I>(columns).push_back(std::move(value));
+				}
+
+				template <typename Rows, std::size_t... I>
+				void append_row(const Rows& rows, std::size_t r, std::index_sequence<I...>) {
+					int dummy[] = { 0, (append_field<I>(rows, r), 0)... };
+					(void)dummy;
+				}
+
+				template <std::size_t I, typename Rows>
+				void append_field(const Rows& rows, std::size_t r) {
+					column_type<I> value{};
+					rows.get_value(r, (int)I, value);
+					std::get<I>(columns).push_back(std::move(value));
+				}
+
+				template <std::size_t... I>
+				void reserve(std::size_t n, std::index_sequence<I...>) {
+					int dummy[] = { 0, (std::get<I>(columns).reserve(n), 0)... };
+					(void)dummy;
+				}
+
+				template <std::size_t... I>
+				std::tuple<Values...> make_row(std::size_t r, std::index_sequence<I...>) const {
+					return std::tuple<Values...>(std::get<I>(columns)[r]...);
+				}
+
+			public:
+				std::size_t size() const {
+					return num_rows;
+				}
+
+				bool empty() const {
+					return num_rows == 0;
+				}
+
+				// number of the refresh that produced this version, from 1
+				unsigned long long version_number() const {
+					return number;
+				}
+
+				std::chrono::system_clock::time_point load_time() const {
+					return loaded_at;
+				}
+
+				template <std::size_t I>
+				const std::vector<column_type<I>>& column() const {
+					return std::get<I>(columns);
+				}
+
+				template <std::size_t I>
+				const column_type<I>& get(std::size_t row) const {
+					return std::get<I>(columns)[row];
+				}
+
+				std::tuple<Values...> row(std::size_t r) const {
+					return make_row(r, std::index_sequence_for<Values...>{});
+				}
+
+				// id of a row whose column `I' equals `key', npos if none; needs a hash index on `I'
+				template <std::size_t I>
+				std::size_t find(const column_type<I>& key) const {
+					if (num_rows == 0) return npos;
+
+					auto& slots = hash_slots<I>();
+					auto& col = std::get<I>(columns);
+
+					std::size_t mask = slots.size() - 1;
+					for (std::size_t h = hash_of(key) & mask; slots[h] != 0; h = (h + 1) & mask)
+						if (col[slots[h] - 1] == key) return slots[h] - 1;
+					return npos;
+				}
+
+				// ids of all rows whose column `I' equals `key'; needs a hash index on `I'
+				template <std::size_t I>
+				std::vector<std::size_t> find_all(const column_type<I>& key) const {
+					if (num_rows == 0) return std::vector<std::size_t>();
+
+					auto& slots = hash_slots<I>();
+					auto& col = std::get<I>(columns);
+
+					// equal keys share their first slot, so they all lie in the cluster that follows it
+					std::vector<std::size_t> res;
+					std::size_t mask = slots.size() - 1;
+					for (std::size_t h = hash_of(key) & mask; slots[h] != 0; h = (h + 1) & mask)
+						if (col[slots[h] - 1] == key) res.push_back(slots[h] - 1);
+
+					std::sort(res.begin(), res.end());
+					return res;
+				}
+
+				// rows whose column `I' equals `key', in column order; needs a sorted index on `I'
+				template <std::size_t I>
+				row_range equal_range(const column_type<I>& key) const {
+					return range<I>(key, key, true);
+				}
+
+				// rows whose column `I' is in [lower, upper), or [lower, upper] if `inclusive', in column order;
+				// needs a sorted index on `I'
+				template <std::size_t I>
+				row_range range(const column_type<I>& lower, const column_type<I>& upper, bool inclusive = false) const {
+					if (num_rows == 0) return row_range();
+
+					auto& ids = sorted_ids<I>();
+					auto& col = std::get<I>(columns);
+
+					auto first = std::lower_bound(ids.begin(), ids.end(), lower, [&](std::uint32_t id, const column_type<I>& v) { return col[id] < v; });
+					auto last = inclusive ?
+						std::upper_bound(first, ids.end(), upper, [&](const column_type<I>& v, std::uint32_t id) { return v < col[id]; }) :
+						std::lower_bound(first, ids.end(), upper, [&](std::uint32_t id, const column_type<I>& v) { return col[id] < v; });
+
+					row_range res;
+					res.first = ids.data() + (first - ids.begin());
+					res.last = ids.data() + (last - ids.begin());
+					return res;
+				}
+
+				// all rows in the order of column `I'; needs a sorted index on `I'
+				template <std::size_t I>
+				row_range ordered_by() const {
+					if (num_rows == 0) return row_range();
+
+					auto& ids = sorted_ids<I>();
+
+					row_range res;
+					res.first = ids.data();
+					res.last = ids.data() + ids.size();
+					return res;
+				}
+			};
+
+		protected:
+			std::string query_str;
+			std::vector<std::function<void(version&)>> index_builders;
+			published_ptr<const version> current_version;
+			unsigned long long num_refreshes = 0;
+			std::mutex refresh_mutex;		// serializes refreshes only, never taken by readers
+
+			std::shared_ptr<version> prepare(std::size_t n, unsigned int num_fields) {
+				if (n > UINT32_MAX - 1) throw std::length_error("Too many rows for a snapshot");
+				if (n > 0 && num_fields < sizeof...(Values)) throw std::invalid_argument("Not enough columns for the snapshot");
+
+				std::shared_ptr<version> v = std::make_shared<version>();
+				v->reserve(n, std::index_sequence_for<Values...>{});
+				return v;
+			}
+
+			std::shared_ptr<const version> publish(std::shared_ptr<version> v, std::size_t n) {
+				v->num_rows = n;
+				for (auto& build : index_builders)
+					build(*v);
+				v->loaded_at = std::chrono::system_clock::now();
+				v->number = ++num_refreshes;
+
+				std::shared_ptr<const version> cv = std::move(v);
+				current_version.store(cv);
+				return cv;
+			}
+
+		public:
+			table_snapshot(const table_snapshot&) = delete;
+			void operator =(const table_snapshot&) = delete;
+
+			// `query' returns the columns in the order of `Values'
+			table_snapshot(const std::string& query)
+				: query_str(query), current_version(std::make_shared<const version>())
+			{}
+
+			// build a hash index on column `I' with every version, for `find' and `find_all'
+			template <std::size_t I>
+			table_snapshot& hash_index() {
+				index_builders.push_back([](version& v) { v.template build_hash_index<I>(); });
+				return *this;
+			}
+
+			// build a sorted index on column `I' with every version, for `equal_range', `range' and `ordered_by'
+			template <std::size_t I>
+			table_snapshot& sorted_index() {
+				index_builders.push_back([](version& v) { v.template build_sorted_index<I>(); });
+				return *this;
+			}
+
+			// build a new version from all rows of `res' and make it current
+			std::shared_ptr<const version> load(result& res) {
+				std::lock_guard<std::mutex> lg(refresh_mutex);
+
+				std::size_t n = res.count();
+				std::shared_ptr<version> v = prepare(n, res.fields());
+
+				for (res.reset(); !res.eof(); res.next())
+					v->append_row(res, std::index_sequence_for<Values...>{});
+				return publish(std::move(v), n);
+			}
+
+			// build a new version from rows in the layout of `result_view' (e.g. a `mapped_result'
+			// saved earlier) and make it current
+			template <typename Rows>
+			std::shared_ptr<const version> load_rows(const Rows& rows) {
+				std::lock_guard<std::mutex> lg(refresh_mutex);
+
+				std::size_t n = rows.count();
+				std::shared_ptr<version> v = prepare(n, rows.fields());
+
+				for (std::size_t r = 0; r < n; r++)
+					v->append_row(rows, r, std::index_sequence_for<Values...>{});
+				return publish(std::move(v), n);
+			}
+
+			// query the table again on `con' and make the result the current version
+			std::shared_ptr<const version> refresh(connection& con) {
+				result res = con.query(query_str);
+				return load(res);
+			}
+
+			// the current version, an empty one before the first refresh (lookups on it find nothing)
+			std::shared_ptr<const version> current() const {
+				return current_version.load();
+			}
+
+			const std::string& query() const {
+				return query_str;
+			}
+		};
+	}
+}
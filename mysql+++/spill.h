@@ -0,0 +1,159 @@
+#pragma once
+
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace daotk {
+	namespace mysql {
+
+		// where the rows of a buffered result go beyond its memory budget (see `connection::set_spill_options')
+		struct spill_options {
+			std::size_t memory_limit = 0;		// bytes of rows kept in memory per result, 0 for no limit
+			std::string directory;				// of the temporary files, empty for the system's default
+		};
+
+
+		// rows appended to an anonymous temporary file, then read in place through a memory mapping
+		//
+		// every row is stored as the end offsets of its fields followed by the fields, each terminated
+		// by a '\0' as in `result_view'; only the position of every row is kept in memory
+		class spill_file {
+		protected:
+			std::FILE* file = nullptr;
+			unsigned int num_fields;
+			std::vector<std::uint64_t> row_offsets;
+			std::uint64_t size = 0;
+			std::vector<std::uint32_t> ends;		// of the row being appended
+
+			const char* base = nullptr;
+			std::size_t length = 0;
+#ifdef _WIN32
+			HANDLE mapping = nullptr;
+#endif
+
+			void write(const void* p, std::size_t n) {
+				if (n > 0 && std::fwrite(p, 1, n, file) != n) throw std::runtime_error("Failed to write a spill file");
+				size += n;
+			}
+
+			static std::FILE* create(const std::string& directory) {
+				if (directory.empty()) return std::tmpfile();
+
+#ifdef _WIN32
+				char* name = _tempnam(directory.c_str(), "mysqlpp");
+				if (name == nullptr) return nullptr;
+
+				// T: temporary, D: deleted when closed
+				std::FILE* f = std::fopen(name, "w+bTD");
+				std::free(name);
+				return f;
+#else
+				std::string name = directory + "/mysqlpp-spill-XXXXXX";
+				int fd = mkstemp(&name[0]);
+				if (fd < 0) return nullptr;
+
+				// anonymous from now on: the space is given back when the file is closed, even after a crash
+				unlink(name.c_str());
+				std::FILE* f = fdopen(fd, "w+b");
+				if (f == nullptr) ::close(fd);
+				return f;
+#endif
+			}
+
+		public:
+			spill_file(const spill_file&) = delete;
+			void operator =(const spill_file&) = delete;
+
+			spill_file(unsigned int _num_fields, const std::string& directory = "")
+				: num_fields(_num_fields), ends(_num_fields)
+			{
+				file = create(directory);
+				if (file == nullptr) throw std::runtime_error("Failed to create a spill file");
+			}
+
+			virtual ~spill_file() {
+#ifdef _WIN32
+				if (base != nullptr) UnmapViewOfFile(base);
+				if (mapping != nullptr) CloseHandle(mapping);
+#else
+				if (base != nullptr) munmap((void*)base, length);
+#endif
+				std::fclose(file);
+			}
+
+			// append a row given as in MYSQL_ROW, with the lengths of its fields
+			void append(const char* const* fields, const unsigned long* lengths) {
+				std::uint32_t end = 0;
+				for (unsigned int i = 0; i < num_fields; i++) {
+					end += (std::uint32_t)lengths[i] + 1;
+					ends[i] = end;
+				}
+
+				row_offsets.push_back(size);
+				write(ends.data(), num_fields * sizeof(std::uint32_t));
+
+				static const char zeros[4] = {};
+				for (unsigned int i = 0; i < num_fields; i++) {
+					write(fields[i], lengths[i]);
+					write(zeros, 1);
+				}
+
+				// keep the offsets of every row aligned
+				write(zeros, (4 - size % 4) % 4);
+			}
+
+			// map the file once all rows are appended
+			void seal() {
+				if (std::fflush(file) != 0) throw std::runtime_error("Failed to write a spill file");
+				if (size == 0 || base != nullptr) return;
+
+				length = (std::size_t)size;
+#ifdef _WIN32
+				HANDLE h = (HANDLE)_get_osfhandle(_fileno(file));
+				mapping = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping == nullptr) throw std::runtime_error("Failed to map a spill file");
+
+				base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				if (base == nullptr) throw std::runtime_error("Failed to map a spill file");
+#else
+				void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fileno(file), 0);
+				if (p == MAP_FAILED) throw std::runtime_error("Failed to map a spill file");
+				base = (const char*)p;
+#endif
+			}
+
+			std::size_t count() const {
+				return row_offsets.size();
+			}
+
+			// field `i' of row `row' and its length, after `seal'
+			const char* field(std::size_t row, unsigned int i, std::size_t& len) const {
+				const char* p = base + row_offsets[row];
+				const std::uint32_t* row_ends = (const std::uint32_t*)p;
+
+				std::uint32_t start = i > 0 ? row_ends[i - 1] : 0;
+				len = row_ends[i] - start - 1;
+				return p + num_fields * sizeof(std::uint32_t) + start;
+			}
+
+			// bytes of the file
+			std::uint64_t file_size() const {
+				return size;
+			}
+		};
+	}
+}
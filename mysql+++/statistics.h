@@ -0,0 +1,396 @@
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <limits>
+
+#include "observer.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		// normalize a statement so that statements differing only in their literals share the same text:
+		// comments are removed, string and numeric literals become `?', lists of them become `?+',
+		// whitespace is collapsed and keywords are lowercased (quoted identifiers are kept as they are)
+		inline std::string fingerprint(const char* sql, std::size_t sql_length) {
+			std::string res;
+			res.reserve(sql_length);
+
+			const char* p = sql;
+			const char* end = sql + sql_length;
+
+			auto is_word = [](char c) {
+				return std::isalnum((unsigned char)c) || c == '_' || c == '$';
+			};
+
+			auto space = [&]() {
+				if (!res.empty() && res.back() != ' ') res += ' ';
+			};
+
+			auto placeholder = [&]() {
+				// "?, ?" and "?+, ?" collapse into "?+"
+				std::size_t n = res.size();
+				while (n > 0 && res[n - 1] == ' ') n--;
+				if (n > 0 && res[n - 1] == ',') {
+					n--;
+					while (n > 0 && res[n - 1] == ' ') n--;
+					if (n > 0 && res[n - 1] == '+') n--;
+					if (n > 0 && res[n - 1] == '?') {
+						res.resize(n);
+						res += '+';
+						return;
+					}
+				}
+				res += '?';
+			};
+
+			while (p < end) {
+				char c = *p;
+
+				if (std::isspace((unsigned char)c)) {
+					space();
+					p++;
+				}
+				else if ((c == '-' && p + 1 < end && p[1] == '-') || c == '#') {
+					while (p < end && *p != '\n') p++;
+					space();
+				}
+				else if (c == '/' && p + 1 < end && p[1] == '*') {
+					p += 2;
+					while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) p++;
+					p = (std::min)(p + 2, end);
+					space();
+				}
+				else if (c == '\'' || c == '"') {
+					// string literal, with backslash escapes and doubled quotes
+					for (p++; p < end; p++) {
+						if (*p == '\\') p++;
+						else if (*p == c) {
+							if (p + 1 < end && p[1] == c) p++;
+							else break;
+						}
+					}
+					if (p < end) p++;
+					placeholder();
+				}
+				else if (c == '`') {
+					const char* start = p;
+					for (p++; p < end && *p != '`'; p++);
+					if (p < end) p++;
+					res.append(start, p);
+				}
+				else if (std::isdigit((unsigned char)c) || (c == '.' && p + 1 < end && std::isdigit((unsigned char)p[1]))) {
+					// number (decimal, float, hexadecimal), unless part of an identifier
+					if (!res.empty() && is_word(res.back())) {
+						while (p < end && is_word(*p)) res += (char)std::tolower((unsigned char)*p++);
+						continue;
+					}
+					bool hex = c == '0' && p + 1 < end && (p[1] == 'x' || p[1] == 'X');
+					for (p++; p < end; p++) {
+						if (is_word(*p) || *p == '.') continue;
+						if (!hex && (*p == '+' || *p == '-') && (p[-1] == 'e' || p[-1] == 'E')) continue;
+						break;
+					}
+					placeholder();
+				}
+				else if (c == ')') {
+					// "(?+), (?+)" collapses into "(?+)", so that multi-row VALUES share a fingerprint
+					res += ')';
+					p++;
+
+					std::size_t open = res.rfind('(');
+					if (open == std::string::npos || open == 0) continue;
+
+					std::size_t n = open;
+					while (n > 0 && res[n - 1] == ' ') n--;
+					if (n == 0 || res[n - 1] != ',') continue;
+					n--;
+					while (n > 0 && res[n - 1] == ' ') n--;
+
+					std::size_t len = res.size() - open;
+					if (n >= len && res.compare(n - len, len, res, open, len) == 0)
+						res.resize(n);
+				}
+				else {
+					res += (char)std::tolower((unsigned char)c);
+					p++;
+				}
+			}
+
+			while (!res.empty() && res.back() == ' ') res.pop_back();
+			return res;
+		}
+
+		inline std::string fingerprint(const std::string& sql) {
+			return fingerprint(sql.c_str(), sql.length());
+		}
+
+
+		// aggregated figures of one fingerprint, as returned by `statement_statistics::snapshot'
+		struct statement_stats {
+			std::string fingerprint;
+			unsigned long long calls = 0;				// statements executed (query, exec, mquery, prepared_stmt::execute)
+			unsigned long long errors = 0;				// statements or fetches that failed
+			std::chrono::nanoseconds total_time{ 0 };	// execution time of the statements, fetches excluded
+			std::chrono::nanoseconds min_time{ 0 };
+			std::chrono::nanoseconds max_time{ 0 };
+			unsigned long long rows_affected = 0;		// rows changed by INSERT, UPDATE, DELETE...
+			unsigned long long rows_returned = 0;		// rows received in results or fetched from prepared statements
+			unsigned long long bytes_returned = 0;		// field data received in results
+
+			std::chrono::nanoseconds mean_time() const {
+				return calls > 0 ? std::chrono::nanoseconds(total_time.count() / (long long)calls) : std::chrono::nanoseconds(0);
+			}
+		};
+
+
+		// client-side statement statistics, in the spirit of pg_stat_statements: attached as the
+		// observer of one or more connections, it aggregates every statement under its fingerprint
+		//
+		// the table is split into shards, each with its own mutex taken only to look a fingerprint up;
+		// the figures themselves are updated with atomic operations
+		class statement_statistics : public query_observer {
+		public:
+			static const unsigned int num_shards = 16;
+
+		protected:
+			struct entry {
+				std::atomic<unsigned long long> calls{ 0 };
+				std::atomic<unsigned long long> errors{ 0 };
+				std::atomic<long long> total_time{ 0 };
+				std::atomic<long long> min_time{ (std::numeric_limits<long long>::max)() };
+				std::atomic<long long> max_time{ 0 };
+				std::atomic<unsigned long long> rows_affected{ 0 };
+				std::atomic<unsigned long long> rows_returned{ 0 };
+				std::atomic<unsigned long long> bytes_returned{ 0 };
+
+				void reset() {
+					calls = 0;
+					errors = 0;
+					total_time = 0;
+					min_time = (std::numeric_limits<long long>::max)();
+					max_time = 0;
+					rows_affected = 0;
+					rows_returned = 0;
+					bytes_returned = 0;
+				}
+			};
+
+			struct shard {
+				std::mutex mutex;
+				std::unordered_map<std::string, std::unique_ptr<entry>> entries;
+				char padding[64];		// keeps the mutexes of neighbouring shards off the same cache line
+			};
+
+			// statement started last on the calling thread, to which the following fetches are attributed
+			// (including those made before the statement ends, as by `mquery')
+			struct last_statement {
+				const statement_statistics* owner = nullptr;
+				const void* stmt = nullptr;
+				const char* sql = nullptr;
+				entry* target = nullptr;
+			};
+
+			static last_statement& last() {
+				static thread_local last_statement ls;
+				return ls;
+			}
+
+			mutable shard shards[num_shards];
+			std::atomic<std::size_t> num_entries{ 0 };
+			std::size_t max_fingerprints;
+			std::function<std::string(const char*, std::size_t)> normalize;
+
+			entry& lookup(const char* sql, std::size_t sql_length) {
+				std::string key = normalize(sql, sql_length);
+				shard& sh = shards[std::hash<std::string>()(key) % num_shards];
+
+				std::unique_lock<std::mutex> lk(sh.mutex);
+				auto itr = sh.entries.find(key);
+				if (itr != sh.entries.end()) return *itr->second;
+
+				// beyond the limit, new fingerprints are aggregated under "(other)"
+				if (num_entries.load(std::memory_order_relaxed) >= max_fingerprints) {
+					lk.unlock();
+					return other();
+				}
+
+				num_entries++;
+				auto& e = sh.entries[key];
+				e.reset(new entry());
+				return *e;
+			}
+
+			entry& other() {
+				static const std::string key = "(other)";
+				shard& sh = shards[std::hash<std::string>()(key) % num_shards];
+
+				std::lock_guard<std::mutex> lg(sh.mutex);
+				auto& e = sh.entries[key];
+				if (!e) e.reset(new entry());
+				return *e;
+			}
+
+			static void update_min(std::atomic<long long>& a, long long v) {
+				long long m = a.load(std::memory_order_relaxed);
+				while (v < m && !a.compare_exchange_weak(m, v, std::memory_order_relaxed));
+			}
+
+			static void update_max(std::atomic<long long>& a, long long v) {
+				long long m = a.load(std::memory_order_relaxed);
+				while (v > m && !a.compare_exchange_weak(m, v, std::memory_order_relaxed));
+			}
+
+		public:
+			statement_statistics(const statement_statistics&) = delete;
+			void operator =(const statement_statistics&) = delete;
+
+			// `max_fingerprints' bounds the memory used by statements built with literals concatenated in;
+			// `normalizer' replaces the default `fingerprint' function
+			statement_statistics(std::size_t _max_fingerprints = 5000,
+				std::function<std::string(const char*, std::size_t)> normalizer = nullptr)
+				: max_fingerprints(_max_fingerprints), normalize(normalizer ? std::move(normalizer) : [](const char* sql, std::size_t len) { return fingerprint(sql, len); })
+			{}
+
+			virtual void on_start(const query_event& event) override {
+				switch (event.kind) {
+				case query_event::query:
+				case query_event::exec:
+				case query_event::mquery:
+				case query_event::stmt_execute: {
+					last_statement& ls = last();
+					ls.owner = this;
+					ls.stmt = event.stmt;
+					ls.sql = event.sql;
+					ls.target = &lookup(event.sql, event.sql_length);
+					break;
+				}
+
+				default:
+					break;
+				}
+			}
+
+			virtual void on_end(const query_event& event) override {
+				last_statement& ls = last();
+				entry* e = nullptr;
+
+				switch (event.kind) {
+				case query_event::query:
+				case query_event::exec:
+				case query_event::mquery:
+				case query_event::stmt_execute: {
+					// looked up when the statement started
+					if (ls.owner == this && ls.stmt == event.stmt && ls.sql == event.sql && ls.target != nullptr) e = ls.target;
+					else {
+						e = &lookup(event.sql, event.sql_length);
+						ls.owner = this;
+						ls.stmt = event.stmt;
+						ls.sql = event.sql;
+						ls.target = e;
+					}
+
+					long long d = (long long)event.duration.count();
+					e->calls.fetch_add(1, std::memory_order_relaxed);
+					e->total_time.fetch_add(d, std::memory_order_relaxed);
+					update_min(e->min_time, d);
+					update_max(e->max_time, d);
+
+					// the rows of an mquery are counted by the fetches of its results
+					if (event.kind != query_event::mquery) e->rows_affected.fetch_add(event.rows, std::memory_order_relaxed);
+					break;
+				}
+
+				case query_event::stmt_fetch:
+					if (ls.owner == this && ls.stmt == event.stmt && ls.target != nullptr) e = ls.target;
+					else {
+						e = &lookup(event.sql, event.sql_length);
+						ls.owner = this;
+						ls.stmt = event.stmt;
+						ls.sql = event.sql;
+						ls.target = e;
+					}
+					e->rows_returned.fetch_add(event.rows, std::memory_order_relaxed);
+					break;
+
+				case query_event::result_fetch:
+					// results are transferred on the thread of their query, after it started
+					if (ls.owner != this || ls.target == nullptr) return;
+					e = ls.target;
+					e->rows_returned.fetch_add(event.rows, std::memory_order_relaxed);
+					e->bytes_returned.fetch_add(event.bytes, std::memory_order_relaxed);
+					break;
+				}
+
+				if (event.error != 0) e->errors.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// copy of the figures of every fingerprint, sorted by decreasing total time
+			std::vector<statement_stats> snapshot() const {
+				std::vector<statement_stats> res;
+
+				for (auto& sh : shards) {
+					std::lock_guard<std::mutex> lg(sh.mutex);
+					for (auto& p : sh.entries) {
+						const entry& e = *p.second;
+
+						statement_stats st;
+						st.fingerprint = p.first;
+						st.calls = e.calls.load(std::memory_order_relaxed);
+						st.errors = e.errors.load(std::memory_order_relaxed);
+						st.total_time = std::chrono::nanoseconds(e.total_time.load(std::memory_order_relaxed));
+						st.min_time = std::chrono::nanoseconds(st.calls > 0 ? e.min_time.load(std::memory_order_relaxed) : 0);
+						st.max_time = std::chrono::nanoseconds(e.max_time.load(std::memory_order_relaxed));
+						st.rows_affected = e.rows_affected.load(std::memory_order_relaxed);
+						st.rows_returned = e.rows_returned.load(std::memory_order_relaxed);
+						st.bytes_returned = e.bytes_returned.load(std::memory_order_relaxed);
+						res.push_back(std::move(st));
+					}
+				}
+
+				std::sort(res.begin(), res.end(), [](const statement_stats& a, const statement_stats& b) {
+					return a.total_time > b.total_time;
+				});
+				return res;
+			}
+
+			// zero all figures; fingerprints stay known
+			void reset() {
+				for (auto& sh : shards) {
+					std::lock_guard<std::mutex> lg(sh.mutex);
+					for (auto& p : sh.entries)
+						p.second->reset();
+				}
+			}
+
+			// text table of the `limit' fingerprints with the highest total time
+			std::string report(std::size_t limit = 20) const {
+				auto stats = snapshot();
+				if (stats.size() > limit) stats.resize(limit);
+
+				std::string res;
+				char line[200];
+				for (auto& st : stats) {
+					std::snprintf(line, sizeof(line), "calls=%llu errors=%llu total=%.3fms mean=%.1fus min=%.1fus max=%.1fus rows=%llu affected=%llu\n  ",
+						st.calls, st.errors, st.total_time.count() / 1e6, st.mean_time().count() / 1e3,
+						st.min_time.count() / 1e3, st.max_time.count() / 1e3, st.rows_returned, st.rows_affected);
+					res += line;
+					res += st.fingerprint;
+					res += '\n';
+				}
+				return res;
+			}
+		};
+	}
+}
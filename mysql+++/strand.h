@@ -0,0 +1,185 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include <memory>
+#include <map>
+#include <tuple>
+#include <stdexcept>
+#include <type_traits>
+
+#include "mysql+++.h"
+#include "lockfree.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		// I/O strand: a dedicated thread owns a connection and runs the requests queued by any number of
+		// threads one after the other, so callers never wait on the connection's mutex and every result
+		// is completely read before the next statement is sent
+		//
+		// the connection is switched to single-owner mode for the lifetime of the strand and must only
+		// be used through it meanwhile; it is switched back to shared mode when the strand is closed
+		class connection_strand {
+		protected:
+			using task = std::function<void(connection&)>;
+
+			std::shared_ptr<connection> con;
+			mpsc_queue<task> queue;
+			std::atomic<std::size_t> pending{ 0 };
+			std::atomic<bool> stopping{ false };
+
+			std::mutex wake_mutex;
+			std::condition_variable wake;
+
+			// prepared statements of `execute', by SQL text; only used by the strand thread
+			std::map<std::string, std::unique_ptr<prepared_stmt>> statements;
+
+			std::thread worker;
+
+
+			void run() {
+				thread_init_guard tg;
+				con->take_ownership();
+
+				while (true) {
+					task t;
+					while (queue.try_pop(t)) {
+						pending--;
+						t(*con);
+					}
+
+					// tasks pushed concurrently with the stop request are drained by the loop above
+					if (stopping.load() && pending.load() == 0) break;
+
+					std::unique_lock<std::mutex> lk(wake_mutex);
+					wake.wait(lk, [this] { return stopping.load() || pending.load() > 0; });
+				}
+
+				statements.clear();
+			}
+
+			void push(task t) {
+				// counted before checking `stopping': the worker does not exit while a task is pending
+				pending++;
+				if (stopping.load()) {
+					pending--;
+					throw std::runtime_error("Strand is closed");
+				}
+				queue.push(std::move(t));
+
+				{ std::lock_guard<std::mutex> lg(wake_mutex); }
+				wake.notify_one();
+			}
+
+			prepared_stmt& statement(connection& c, const std::string& sql) {
+				auto& st = statements[sql];
+				if (!st) st.reset(new prepared_stmt(c, sql));
+				return *st;
+			}
+
+			template <typename Tuple, std::size_t... I>
+			static void bind_tuple(prepared_stmt& st, const Tuple& params, std::index_sequence<I...>) {
+				st.bind_param(std::get<I>(params)...);
+			}
+
+		public:
+			connection_strand(const connection_strand&) = delete;
+			void operator =(const connection_strand&) = delete;
+
+			connection_strand(std::shared_ptr<connection> pcon)
+				: con(std::move(pcon))
+			{
+				con->set_threading_mode(threading_mode::single_owner);
+				worker = std::thread(&connection_strand::run, this);
+			}
+
+			// open a connection dedicated to the strand
+			connection_strand(const connect_options& options)
+				: connection_strand(std::make_shared<connection>(options))
+			{
+				if (!con->is_open()) {
+					std::string msg = con->error_message();
+					close();
+					throw std::runtime_error("Failed to connect: " + msg);
+				}
+			}
+
+			virtual ~connection_strand() {
+				close();
+			}
+
+			// queue `fn(connection&)' and return a future for its return value or exception;
+			// `fn' runs on the strand thread and must read any result it produces before returning
+			template <typename Function>
+			auto submit(Function fn) -> std::future<decltype(fn(std::declval<connection&>()))> {
+				using value_type = decltype(fn(std::declval<connection&>()));
+
+				auto pt = std::make_shared<std::packaged_task<value_type(connection&)>>(std::move(fn));
+				auto res = pt->get_future();
+				push([pt](connection& c) { (*pt)(c); });
+				return res;
+			}
+
+			// run a query; the result is completely fetched on the strand thread
+			std::future<result> query(const std::string& sql) {
+				return submit([sql](connection& c) {
+					result res = c.query(sql);
+					res.count();
+					return res;
+				});
+			}
+
+			// run a statement and return the number of affected rows
+			std::future<unsigned long long> exec(const std::string& sql) {
+				return submit([sql](connection& c) {
+					c.exec(sql);
+					return c.affected_rows();
+				});
+			}
+
+			// execute a prepared statement (prepared once, on first use) with the given parameters and
+			// return the number of affected rows; statements returning rows should go through `submit'
+			template <typename... Values>
+			std::future<unsigned long long> execute(const std::string& sql, Values... values) {
+				auto params = std::make_tuple(std::move(values)...);
+
+				return submit([this, sql, params](connection& c) {
+					prepared_stmt& st = statement(c, sql);
+					bind_tuple(st, params, std::index_sequence_for<Values...>{});
+					if (!st.execute())
+						throw std::runtime_error(std::string("Failed to execute stmt: ") + st.error_message());
+					return st.affected_rows();
+				});
+			}
+
+			// requests queued but not started yet
+			std::size_t queued() const {
+				return pending.load();
+			}
+
+			// run what is still queued, stop the strand thread and hand the connection back
+			void close() {
+				if (!worker.joinable()) return;
+
+				{
+					std::lock_guard<std::mutex> lg(wake_mutex);
+					stopping = true;
+				}
+				wake.notify_one();
+				worker.join();
+
+				con->set_threading_mode(threading_mode::shared);
+			}
+
+			std::shared_ptr<connection> get_connection() const {
+				return con;
+			}
+		};
+	}
+}
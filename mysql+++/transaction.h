@@ -0,0 +1,292 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "mysql+++.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		enum class isolation_level {
+			default_level,		// keep the session's setting
+			read_uncommitted,
+			read_committed,
+			repeatable_read,
+			serializable
+		};
+
+
+		// RAII transaction: started on construction, rolled back on destruction unless committed;
+		// throws std::logic_error if the connection is already in a transaction (autocommit off), which
+		// it would otherwise adopt and then commit or roll back
+		class transaction {
+			friend class savepoint;
+
+		protected:
+			connection& con;
+			bool active = false;
+			bool restore_autocommit = false;
+			unsigned int savepoint_counter = 0;
+
+			void finish() {
+				active = false;
+				if (restore_autocommit) con.set_autocommit(true);
+			}
+
+		public:
+			transaction(const transaction&) = delete;
+			void operator =(const transaction&) = delete;
+
+			transaction(connection& pcon, isolation_level level = isolation_level::default_level)
+				: con(pcon)
+			{
+				if (con.in_transaction()) throw std::logic_error("Connection already in a transaction");
+
+				// SET TRANSACTION only affects the next transaction, so it must come first
+				switch (level) {
+				case isolation_level::read_uncommitted: con.exec("set transaction isolation level read uncommitted"); break;
+				case isolation_level::read_committed: con.exec("set transaction isolation level read committed"); break;
+				case isolation_level::repeatable_read: con.exec("set transaction isolation level repeatable read"); break;
+				case isolation_level::serializable: con.exec("set transaction isolation level serializable"); break;
+				default: break;
+				}
+
+				restore_autocommit = con.autocommit();
+				if (restore_autocommit) con.set_autocommit(false);
+				active = true;
+			}
+
+			virtual ~transaction() {
+				if (active) {
+					try {
+						rollback();
+					}
+					catch (...) {}
+				}
+			}
+
+			void commit() {
+				con.commit();
+				finish();
+			}
+
+			void rollback() {
+				con.rollback();
+				finish();
+			}
+
+			bool is_active() const {
+				return active;
+			}
+		};
+
+
+		// RAII savepoint inside a transaction: rolled back to on destruction unless released;
+		// savepoints can be nested by creating several of them on the same transaction
+		class savepoint {
+		protected:
+			connection& con;
+			std::string name;
+			bool active;
+
+		public:
+			savepoint(const savepoint&) = delete;
+			void operator =(const savepoint&) = delete;
+
+			savepoint(transaction& tx)
+				: con(tx.con), active(false)
+			{
+				name = "mysqlpp_sp" + std::to_string(++tx.savepoint_counter);
+				con.exec("savepoint " + name);
+				active = true;
+			}
+
+			virtual ~savepoint() {
+				if (active) {
+					try {
+						rollback();
+					}
+					catch (...) {}
+				}
+			}
+
+			// keep the changes made since the savepoint as part of the transaction
+			void release() {
+				con.exec("release savepoint " + name);
+				active = false;
+			}
+
+			// undo the changes made since the savepoint, the transaction stays open
+			void rollback() {
+				con.exec("rollback to savepoint " + name);
+				active = false;
+			}
+
+			bool is_active() const {
+				return active;
+			}
+		};
+
+
+		struct group_commit_options {
+			std::size_t max_batch = 64;							// maximum number of callers sharing one commit
+			std::chrono::microseconds max_delay{ 0 };			// how long to wait for more callers before committing
+			isolation_level level = isolation_level::default_level;
+		};
+
+
+		// group commit: independent units of work submitted from many threads are executed by one
+		// thread on a dedicated connection and share a single commit (and its fsync)
+		//
+		// each unit runs inside its own savepoint, so a failing unit is rolled back alone and its
+		// exception is delivered through its future; the others still commit
+		class group_commit {
+		protected:
+			struct job {
+				std::function<void(connection&)> work;
+				std::promise<void> done;
+			};
+
+			connection& con;
+			group_commit_options options;
+
+			std::mutex jobs_mutex;
+			std::condition_variable jobs_cv;
+			std::vector<job> jobs;
+			bool stopping = false;
+
+			std::atomic<unsigned long long> num_commits{ 0 };
+			std::atomic<unsigned long long> num_jobs{ 0 };
+
+			std::thread worker;
+
+
+			void run_batch(std::vector<job>& batch) {
+				std::vector<std::exception_ptr> errors(batch.size());
+
+				try {
+					transaction tx(con, options.level);
+
+					for (std::size_t i = 0; i < batch.size(); i++) {
+						savepoint sp(tx);
+						try {
+							batch[i].work(con);
+							sp.release();
+						}
+						catch (...) {
+							errors[i] = std::current_exception();
+							sp.rollback();
+						}
+					}
+
+					tx.commit();
+					num_commits++;
+				}
+				catch (...) {
+					// the transaction itself failed: nothing of this batch was committed
+					for (auto& e : errors)
+						if (!e) e = std::current_exception();
+				}
+
+				for (std::size_t i = 0; i < batch.size(); i++) {
+					if (errors[i]) batch[i].done.set_exception(errors[i]);
+					else {
+						batch[i].done.set_value();
+						num_jobs++;
+					}
+				}
+			}
+
+			void run() {
+				thread_init_guard tg;
+				std::vector<job> batch;
+
+				while (true) {
+					{
+						std::unique_lock<std::mutex> lk(jobs_mutex);
+						jobs_cv.wait(lk, [this] { return stopping || !jobs.empty(); });
+						if (jobs.empty()) break;
+
+						// give concurrent callers a chance to join this commit
+						if (options.max_delay.count() > 0 && jobs.size() < options.max_batch)
+							jobs_cv.wait_for(lk, options.max_delay, [this] { return stopping || jobs.size() >= options.max_batch; });
+
+						std::size_t n = (std::min)(jobs.size(), options.max_batch);
+						std::move(jobs.begin(), jobs.begin() + n, std::back_inserter(batch));
+						jobs.erase(jobs.begin(), jobs.begin() + n);
+					}
+
+					run_batch(batch);
+					batch.clear();
+				}
+			}
+
+		public:
+			group_commit(const group_commit&) = delete;
+			void operator =(const group_commit&) = delete;
+
+			group_commit(connection& pcon, const group_commit_options& opts = group_commit_options())
+				: con(pcon), options(opts)
+			{
+				if (options.max_batch == 0) options.max_batch = 1;
+				worker = std::thread(&group_commit::run, this);
+			}
+
+			virtual ~group_commit() {
+				close();
+			}
+
+			// queue a unit of work; the future is ready once it has been committed; throws once closed
+			std::future<void> submit(std::function<void(connection&)> work) {
+				job j;
+				j.work = std::move(work);
+				std::future<void> res = j.done.get_future();
+
+				{
+					// the committing thread only exits with `stopping' set and no job left
+					std::lock_guard<std::mutex> lg(jobs_mutex);
+					if (stopping) throw std::runtime_error("Group commit is closed");
+					jobs.push_back(std::move(j));
+				}
+				jobs_cv.notify_one();
+
+				return res;
+			}
+
+			// submit and wait for the commit, rethrowing the unit's error if any
+			void execute(std::function<void(connection&)> work) {
+				submit(std::move(work)).get();
+			}
+
+			// run what is still queued and stop the committing thread
+			void close() {
+				if (!worker.joinable()) return;
+
+				{
+					std::lock_guard<std::mutex> lg(jobs_mutex);
+					stopping = true;
+				}
+				jobs_cv.notify_one();
+				worker.join();
+			}
+
+			unsigned long long commits() const {
+				return num_commits;
+			}
+
+			unsigned long long jobs_committed() const {
+				return num_jobs;
+			}
+		};
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+
+#include "mysql+++.h"
+
+
+namespace daotk {
+	namespace mysql {
+
+		struct warmup_options {
+			std::vector<std::string> init_statements;	// executed on every connection after connecting
+			std::vector<std::string> prepare;			// statements prepared on every connection
+			unsigned int parallelism = 0;				// number of connecting threads, 0 for one per connection
+		};
+
+
+		// time spent in each setup phase of one connection
+		struct warmup_timing {
+			std::chrono::microseconds connect{ 0 };		// mysql_real_connect: TCP, TLS handshake, authentication, init_command
+			std::chrono::microseconds init{ 0 };		// `warmup_options::init_statements'
+			std::chrono::microseconds prepare{ 0 };		// `warmup_options::prepare'
+			std::chrono::microseconds total{ 0 };
+		};
+
+
+		struct warmed_connection {
+			std::shared_ptr<connection> conn;
+			std::vector<std::shared_ptr<prepared_stmt>> statements;		// in the order of `warmup_options::prepare'
+			warmup_timing timing;
+			std::exception_ptr error;									// set if any setup step failed
+
+			bool ok() const {
+				return !error;
+			}
+		};
+
+
+		// open and prepare a single connection, measuring each phase
+		inline warmed_connection warm_up_connection(const connect_options& options, const warmup_options& wopts = warmup_options()) {
+			using clock = std::chrono::steady_clock;
+			auto us = [](clock::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d); };
+
+			warmed_connection res;
+			auto t0 = clock::now();
+
+			try {
+				res.conn = std::make_shared<connection>();
+				if (!res.conn->open(options))
+					throw std::runtime_error(std::string("Failed to connect: ") + res.conn->error_message());
+				auto t1 = clock::now();
+				res.timing.connect = us(t1 - t0);
+
+				for (auto& st : wopts.init_statements)
+					res.conn->exec(st);
+				auto t2 = clock::now();
+				res.timing.init = us(t2 - t1);
+
+				for (auto& st : wopts.prepare)
+					res.statements.push_back(std::make_shared<prepared_stmt>(*res.conn, st));
+				res.timing.prepare = us(clock::now() - t2);
+			}
+			catch (...) {
+				res.error = std::current_exception();
+			}
+
+			res.timing.total = us(clock::now() - t0);
+			return res;
+		}
+
+
+		// establish `count' connections concurrently, so that the total setup time is close to that of
+		// the slowest connection instead of the sum of all of them; failures are reported per connection
+		inline std::vector<warmed_connection> warm_up(const connect_options& options, std::size_t count, const warmup_options& wopts = warmup_options()) {
+			std::vector<warmed_connection> res(count);
+			if (count == 0) return res;
+
+			// mysql_init() would initialize the library itself, but that is not thread-safe
+			mysql_library_init(0, nullptr, nullptr);
+
+			std::size_t num_threads = wopts.parallelism > 0 ? std::min<std::size_t>(wopts.parallelism, count) : count;
+			std::atomic<std::size_t> next{ 0 };
+
+			auto work = [&]() {
+				thread_init_guard tg;
+				for (std::size_t i; (i = next++) < count; )
+					res[i] = warm_up_connection(options, wopts);
+			};
+
+			std::vector<std::thread> threads;
+			for (std::size_t i = 0; i < num_threads; i++)
+				threads.emplace_back(work);
+
+			for (auto& t : threads)
+				t.join();
+
+			return res;
+		}
+	}
+}
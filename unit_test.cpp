@@ -0,0 +1,769 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <string>
+#include <limits>
+#include <stdexcept>
+#include <future>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+
+// checks of the parts of the library that need no server; the program still links with the client library
+#include "mysql+++/mysql+++.h"
+#include "mysql+++/lockfree.h"
+#include "mysql+++/coalescing_writer.h"
+#include "mysql+++/transaction.h"
+#include "mysql+++/strand.h"
+#include "mysql+++/statistics.h"
+#include "mysql+++/binlog.h"
+#include "mysql+++/snapshot.h"
+#include "mysql+++/mapped.h"
+
+
+using namespace std;
+using namespace daotk::mysql;
+
+
+static int failures = 0;
+
+static void check(bool condition, const char* expr, int line)
+{
+	if (!condition) {
+		cout << "FAILED line " << line << ": " << expr << endl;
+		failures++;
+	}
+}
+
+#define CHECK(expr) check((expr), #expr, __LINE__)
+
+// true if `fn()' throws an `Exception'
+template <typename Exception, typename Function>
+static bool throws(Function fn)
+{
+	try {
+		fn();
+	}
+	catch (Exception&) {
+		return true;
+	}
+	catch (...) {}
+	return false;
+}
+
+
+
+static void test_queues()
+{
+	cout << "** LOCK-FREE QUEUES" << endl;
+
+	// single-threaded: capacity rounding, full and empty rings, order
+	spsc_ring<int> ring(5);
+	CHECK(ring.capacity() == 8);
+	CHECK(ring.empty());
+
+	for (int i = 0; i < 8; i++)
+		CHECK(ring.try_push(int(i)));
+	CHECK(!ring.try_push(8));
+	CHECK(ring.size() == 8);
+
+	int v = -1;
+	for (int i = 0; i < 8; i++) {
+		CHECK(ring.try_pop(v));
+		CHECK(v == i);
+	}
+	CHECK(!ring.try_pop(v));
+
+	// one producer and one consumer: every value arrives once, in order
+	const int n = 100000;
+	spsc_ring<int> shared_ring(64);
+	thread producer([&] {
+		for (int i = 0; i < n; i++)
+			while (!shared_ring.try_push(int(i))) this_thread::yield();
+	});
+
+	bool ordered = true;
+	for (int expected = 0; expected < n; ) {
+		if (!shared_ring.try_pop(v)) {
+			this_thread::yield();
+			continue;
+		}
+		if (v != expected) ordered = false;
+		expected++;
+	}
+	producer.join();
+	CHECK(ordered);
+	CHECK(shared_ring.empty());
+
+	// several producers: every value arrives once, in the order of its producer
+	const int num_producers = 4, per_producer = 20000;
+	mpsc_queue<pair<int, int>> queue;
+	vector<thread> producers;
+	for (int p = 0; p < num_producers; p++) {
+		producers.emplace_back([&queue, p] {
+			for (int i = 0; i < per_producer; i++)
+				queue.push(make_pair(p, i));
+		});
+	}
+
+	vector<int> next(num_producers, 0);
+	ordered = true;
+	pair<int, int> item;
+	for (int received = 0; received < num_producers * per_producer; ) {
+		if (!queue.try_pop(item)) {
+			this_thread::yield();
+			continue;
+		}
+		if (item.second != next[item.first]) ordered = false;
+		next[item.first]++;
+		received++;
+	}
+	for (auto& t : producers)
+		t.join();
+	CHECK(ordered);
+	CHECK(!queue.try_pop(item));
+}
+
+
+
+// the background threads below are given a connection that was never opened: none of these checks
+// reaches a statement
+static void test_writer()
+{
+	cout << "** COALESCING WRITER" << endl;
+
+	connection con;
+	coalescing_writer writer(con, "person", { "name", "weight" });
+
+	CHECK(throws<invalid_argument>([&] { writer.insert("Nguyen Van X", numeric_limits<double>::quiet_NaN()); }));
+	CHECK(throws<invalid_argument>([&] { writer.insert("Nguyen Van X", -numeric_limits<double>::infinity()); }));
+	CHECK(throws<invalid_argument>([&] { writer.insert("Nguyen Van X"); }));
+
+	writer.close();
+	CHECK(writer.rows_written() == 0 && writer.rows_failed() == 0);
+
+	CHECK(throws<logic_error>([&] { writer.insert("Tran Thi Y", 56.78); }));
+	CHECK(throws<logic_error>([&] { writer.flush(); }));
+}
+
+
+
+static void test_group_commit()
+{
+	cout << "** GROUP COMMIT" << endl;
+
+	connection con;
+	group_commit gc(con);
+
+	// queued before closing: answered by `close', here with the error of the unopened connection
+	future<void> queued = gc.submit([](connection&) {});
+	gc.close();
+	CHECK(queued.wait_for(chrono::seconds(0)) == future_status::ready);
+	CHECK(throws<mysql_exception>([&] { queued.get(); }));
+
+	CHECK(throws<runtime_error>([&] { gc.submit([](connection&) {}); }));
+	CHECK(gc.jobs_committed() == 0);
+}
+
+
+
+static void test_strand()
+{
+	cout << "** CONNECTION STRAND" << endl;
+
+	auto con = make_shared<connection>();
+	connection_strand strand(con);
+
+	// tasks run in submission order on the strand thread
+	vector<int> order;
+	vector<future<int>> results;
+	for (int i = 0; i < 100; i++)
+		results.push_back(strand.submit([&order, i](connection&) { order.push_back(i); return i * 2; }));
+
+	bool values = true;
+	for (int i = 0; i < 100; i++)
+		if (results[i].get() != i * 2) values = false;
+	CHECK(values);
+
+	bool ordered = order.size() == 100;
+	for (int i = 0; ordered && i < 100; i++)
+		if (order[i] != i) ordered = false;
+	CHECK(ordered);
+
+	auto thrown = strand.submit([](connection&) -> int { throw runtime_error("task failed"); });
+	CHECK(throws<runtime_error>([&] { thrown.get(); }));
+
+	// submitted before closing: run by `close'
+	auto last = strand.submit([](connection&) { return 7; });
+	strand.close();
+	CHECK(last.wait_for(chrono::seconds(0)) == future_status::ready && last.get() == 7);
+	CHECK(strand.queued() == 0);
+
+	CHECK(throws<runtime_error>([&] { strand.submit([](connection&) { return 0; }); }));
+}
+
+
+
+// a finished operation, as reported to observers
+static query_event make_event(query_event::kind_type kind, const char* sql, long long ns, unsigned long long rows, unsigned long long bytes = 0, unsigned int error = 0)
+{
+	query_event event;
+	event.kind = kind;
+	event.sql = sql;
+	event.sql_length = sql != nullptr ? strlen(sql) : 0;
+	event.stmt = nullptr;
+	event.duration = chrono::nanoseconds(ns);
+	event.rows = rows;
+	event.bytes = bytes;
+	event.error = error;
+	return event;
+}
+
+static void test_statistics()
+{
+	cout << "** STATEMENT STATISTICS" << endl;
+
+	CHECK(fingerprint("SELECT * FROM person WHERE id = 42") == "select * from person where id = ?");
+	CHECK(fingerprint("select *  from person\n where id = 7 -- comment") == "select * from person where id = ?");
+	CHECK(fingerprint("select * from person where name = 'it''s' /* comment */") == "select * from person where name = ?");
+	CHECK(fingerprint("insert into t values (1, 'a'), (2, 'b'), (3,'c')") == "insert into t values (?+)");
+	CHECK(fingerprint("select * from t where id in (1, 2, 3)") == "select * from t where id in (?+)");
+	CHECK(fingerprint("select `Weird Name` from t") == "select `Weird Name` from t");
+
+	statement_statistics stats(3);
+
+	const char* first = "select name from person where id = 1";
+	const char* second = "select name from person where id = 2";
+	stats.on_start(make_event(query_event::query, first, 0, 0));
+	stats.on_end(make_event(query_event::query, first, 3000, 0));
+	stats.on_end(make_event(query_event::result_fetch, nullptr, 0, 1, 12));
+	stats.on_start(make_event(query_event::query, second, 0, 0));
+	stats.on_end(make_event(query_event::query, second, 1000, 0, 0, 1146));
+
+	const char* update = "update person set weight = 60 where id = 3";
+	stats.on_start(make_event(query_event::exec, update, 0, 0));
+	stats.on_end(make_event(query_event::exec, update, 500, 1));
+
+	vector<statement_stats> snap = stats.snapshot();
+	CHECK(snap.size() == 2);
+	if (snap.size() == 2) {
+		// sorted by decreasing total time
+		const statement_stats& select = snap[0];
+		CHECK(select.fingerprint == "select name from person where id = ?");
+		CHECK(select.calls == 2);
+		CHECK(select.errors == 1);
+		CHECK(select.total_time == chrono::nanoseconds(4000));
+		CHECK(select.min_time == chrono::nanoseconds(1000) && select.max_time == chrono::nanoseconds(3000));
+		CHECK(select.mean_time() == chrono::nanoseconds(2000));
+		CHECK(select.rows_returned == 1 && select.bytes_returned == 12);
+
+		CHECK(snap[1].fingerprint == "update person set weight = ? where id = ?");
+		CHECK(snap[1].rows_affected == 1);
+	}
+
+	// beyond `max_fingerprints' (3), new statements are counted together
+	for (const char* sql : { "delete from a", "delete from b", "delete from c" }) {
+		stats.on_start(make_event(query_event::exec, sql, 0, 0));
+		stats.on_end(make_event(query_event::exec, sql, 10, 0));
+	}
+
+	unsigned long long other_calls = 0;
+	for (auto& st : stats.snapshot())
+		if (st.fingerprint == "(other)") other_calls = st.calls;
+	CHECK(other_calls == 2);
+
+	stats.reset();
+	bool cleared = true;
+	for (auto& st : stats.snapshot())
+		if (st.calls != 0) cleared = false;
+	CHECK(cleared);
+}
+
+
+
+// true if the Prometheus text `text' has the line `line'
+static bool has_line(const string& text, const string& line)
+{
+	return ("\n" + text).find("\n" + line + "\n") != string::npos;
+}
+
+static void test_metrics()
+{
+	cout << "** METRICS" << endl;
+
+	// striped counters add up across threads
+	metric_counter counter;
+	vector<thread> threads;
+	for (int t = 0; t < 4; t++)
+		threads.emplace_back([&counter] {
+			for (int i = 0; i < 10000; i++)
+				counter.add();
+		});
+	for (auto& t : threads)
+		t.join();
+	CHECK(counter.value() == 40000);
+
+	metrics_registry registry("test_");
+	registry.record(make_event(query_event::query, "select 1", 1500000000, 0));
+	registry.record(make_event(query_event::exec, "delete from t", 250000000, 3, 0, 1213));
+	registry.record(make_event(query_event::result_fetch, nullptr, 0, 2, 40));
+
+	metric_gauge& size = registry.gauge("pool_size", "Connections in the pool.", "pool=\"main\"");
+	size.set(5);
+	size.add(2);
+	size.sub();
+	CHECK(&registry.gauge("pool_size", "Connections in the pool.", "pool=\"main\"") == &size);
+	registry.counter("waits_total", "Waits for a connection.").add(4);
+
+	CHECK(registry.error_count(1213) == 1);
+	CHECK(registry.error_count(1146) == 0);
+
+	string text = registry.render();
+	CHECK(has_line(text, "# TYPE test_statements_total counter"));
+	CHECK(has_line(text, "test_statements_total{kind=\"query\"} 1"));
+	CHECK(has_line(text, "test_statements_total{kind=\"exec\"} 1"));
+	CHECK(has_line(text, "test_statements_total{kind=\"mquery\"} 0"));
+	CHECK(has_line(text, "test_statement_seconds_total{kind=\"query\"} 1.5"));
+	CHECK(has_line(text, "test_statement_seconds_total{kind=\"exec\"} 0.25"));
+	CHECK(has_line(text, "test_rows_fetched_total 2"));
+	CHECK(has_line(text, "test_bytes_received_total 40"));
+	CHECK(has_line(text, "test_errors_total{code=\"1213\"} 1"));
+	CHECK(has_line(text, "# TYPE test_pool_size gauge"));
+	CHECK(has_line(text, "test_pool_size{pool=\"main\"} 6"));
+	CHECK(has_line(text, "test_waits_total 4"));
+}
+
+
+
+// feeds binary log packets to the listener's parser, without reading from a server
+class binlog_parser : public binlog_listener {
+public:
+	binlog_parser()
+		: binlog_listener(connect_options())
+	{}
+
+	void feed(const vector<unsigned char>& packet)
+	{
+		on_event(packet.data(), packet.size());
+	}
+};
+
+static void test_binlog_events()
+{
+	cout << "** BINLOG EVENTS" << endl;
+
+	// events as the server sends them (binlog v4, checksums off), each after the OK byte of its packet
+
+	// query: BEGIN, on `test`, ends at 300
+	const vector<unsigned char> begin = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x02, 0x01, 0x00, 0x00, 0x00, 0x2f, 0x00, 0x00, 0x00, 0x2c, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x05,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x74, 0x65, 0x73, 0x74, 0x00, 0x42, 0x45, 0x47, 0x49, 0x4e
+	};
+
+	// table map: id 85 is test.person, ends at 360
+	const vector<unsigned char> map_person = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x13, 0x01, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x68, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x55, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x04, 0x74, 0x65, 0x73,
+		0x74, 0x00, 0x06, 0x70, 0x65, 0x72, 0x73, 0x6f, 0x6e, 0x00, 0x02, 0x03, 0x0f, 0x02, 0xc8, 0x00,
+		0x02
+	};
+
+	// table map: id 86 is test.other, ends at 410
+	const vector<unsigned char> map_other = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x13, 0x01, 0x00, 0x00, 0x00, 0x2f, 0x00, 0x00, 0x00, 0x9a, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x56, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x04, 0x74, 0x65, 0x73,
+		0x74, 0x00, 0x05, 0x6f, 0x74, 0x68, 0x65, 0x72, 0x00, 0x02, 0x03, 0x0f, 0x02, 0xc8, 0x00, 0x02
+	};
+
+	// write rows (v2) on table 85, ends at 450
+	const vector<unsigned char> insert_person = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x1e, 0x01, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0xc2, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x55, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00, 0x02, 0xff,
+		0xfc, 0x07, 0x00, 0x00, 0x00, 0x03, 0x41, 0x6e, 0x6e
+	};
+
+	// update rows (v2) on table 85, ends at 490
+	const vector<unsigned char> update_person = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x1f, 0x01, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0xea, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x55, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00, 0x02, 0xff,
+		0xfc, 0x07, 0x00, 0x00, 0x00, 0x03, 0x41, 0x6e, 0x6e
+	};
+
+	// delete rows (v2) on table 86, ends at 530
+	const vector<unsigned char> delete_other = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x20, 0x01, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x12, 0x02,
+		0x00, 0x00, 0x00, 0x00, 0x56, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00, 0x02, 0xff,
+		0xfc, 0x07, 0x00, 0x00, 0x00, 0x03, 0x41, 0x6e, 0x6e
+	};
+
+	// XID (commit), ends at 561
+	const vector<unsigned char> xid = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x10, 0x01, 0x00, 0x00, 0x00, 0x1b, 0x00, 0x00, 0x00, 0x31, 0x02,
+		0x00, 0x00, 0x00, 0x00, 0x34, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+
+	// query: TRUNCATE TABLE person, on `test`, ends at 650
+	const vector<unsigned char> truncate = {
+		0x00, 0xf0, 0xa3, 0x12, 0x67, 0x02, 0x01, 0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0x8a, 0x02,
+		0x00, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x05,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x74, 0x65, 0x73, 0x74, 0x00, 0x54, 0x52, 0x55, 0x4e, 0x43,
+		0x41, 0x54, 0x45, 0x20, 0x54, 0x41, 0x42, 0x4c, 0x45, 0x20, 0x70, 0x65, 0x72, 0x73, 0x6f, 0x6e
+	};
+
+	// rotate to binlog.000002, position 4 (artificial event: log_pos 0)
+	const vector<unsigned char> rotate = {
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x62, 0x69, 0x6e, 0x6c,
+		0x6f, 0x67, 0x2e, 0x30, 0x30, 0x30, 0x30, 0x30, 0x32
+	};
+
+	vector<string> changes;
+	auto record = [&changes](const string& db, const string& table, table_change change) {
+		static const char* names[] = { "insert", "update", "remove", "statement", "unknown" };
+		changes.push_back(db + "." + table + " " + names[(int)change]);
+	};
+
+	binlog_parser parser;
+	parser.watch("test", "person", record);
+	parser.watch("", "other", record);
+
+	parser.feed({ 0x00, 0x01, 0x02 });		// too short: ignored
+	parser.feed(begin);
+	parser.feed(map_person);
+	parser.feed(map_other);
+	parser.feed(insert_person);
+	parser.feed(update_person);
+	parser.feed(delete_other);
+
+	// inside the transaction, the resume position stays at its start
+	CHECK(parser.stats().position == 4);
+
+	parser.feed(xid);
+	CHECK(parser.stats().position == 561);
+
+	parser.feed(truncate);
+	CHECK(parser.stats().position == 650);
+
+	parser.feed(rotate);
+	CHECK(parser.stats().file == "binlog.000002" && parser.stats().position == 4);
+
+	// table ids are only valid until the next rotation
+	parser.feed(insert_person);
+
+	vector<string> expected = { "test.person insert", "test.person update", ".other remove", "test.person statement" };
+	CHECK(changes == expected);
+	CHECK(parser.stats().events == 10);
+	CHECK(parser.stats().row_events == 3);
+}
+
+
+
+// a fully fetched result built from strings, standing for one read from the server (empty fields are NULL)
+class fixed_result : public result {
+public:
+	fixed_result(const vector<vector<string>>& data, unsigned int fields)
+	{
+		for (auto& r : data) {
+			rows.emplace_back();
+			for (auto& f : r)
+				rows.back().emplace_back(f.data(), f.size());
+		}
+		num_rows = rows.size();
+		num_fields = fields;
+		fetched = true;
+	}
+};
+
+static void test_snapshot()
+{
+	cout << "** TABLE SNAPSHOT" << endl;
+
+	table_snapshot<int, string, double> products("select id, name, price from product");
+	products.hash_index<0>().hash_index<1>().sorted_index<2>();
+
+	// nothing is found before the first load
+	auto empty = products.current();
+	CHECK(empty->empty());
+	CHECK(empty->find<0>(1) == products.npos);
+	CHECK(empty->find_all<1>("pen").empty());
+	CHECK(empty->range<2>(0.0, 10.0).empty());
+
+	fixed_result res({
+		{ "1", "pen", "1.5" },
+		{ "2", "ink", "3" },
+		{ "3", "pen", "2" },
+		{ "4", "cap", "0.5" },
+		{ "5", "pen", "3" }
+	}, 3);
+	auto v = products.load(res);
+	CHECK(v == products.current());
+	CHECK(v->size() == 5 && v->version_number() == 1);
+
+	CHECK(v->find<0>(3) == 2);
+	CHECK(v->get<1>(v->find<0>(4)) == "cap");
+	CHECK(v->find<0>(9) == products.npos);
+	CHECK(v->find_all<1>("pen") == vector<size_t>({ 0, 2, 4 }));
+	CHECK(v->find_all<1>("box").empty());
+
+	row_range cheap = v->range<2>(1.0, 3.0);
+	CHECK(cheap.size() == 2 && cheap.begin()[0] == 0 && cheap.begin()[1] == 2);
+	CHECK(v->range<2>(1.0, 3.0, true).size() == 4);
+	CHECK(v->equal_range<2>(3.0).size() == 2);
+	CHECK(v->range<2>(5.0, 9.0).empty());
+	CHECK(*v->ordered_by<2>().begin() == 3);
+	CHECK(get<1>(v->row(3)) == "cap");
+
+	// many equal keys: all of them are found whatever the collisions
+	vector<vector<string>> many;
+	for (int i = 0; i < 1000; i++)
+		many.push_back({ to_string(i), "name" + to_string(i % 10), to_string(i % 7) });
+	fixed_result many_res(many, 3);
+	products.load(many_res);
+
+	auto w = products.current();
+	CHECK(w->version_number() == 2 && w->size() == 1000);
+	bool all_found = true;
+	for (int k = 0; k < 10; k++) {
+		auto ids = w->find_all<1>("name" + to_string(k));
+		if (ids.size() != 100) all_found = false;
+		for (auto id : ids)
+			if (id % 10 != (size_t)k) all_found = false;
+	}
+	CHECK(all_found);
+	CHECK(w->find<0>(999) == 999);
+	CHECK(w->equal_range<2>(6.0).size() == 142);
+
+	// a version keeps its rows after being replaced
+	CHECK(v->size() == 5 && v->find<0>(5) == 4);
+
+	// readers copying the pointer while it is being replaced always get a whole version
+	published_ptr<const pair<int, int>> shared(make_shared<const pair<int, int>>(0, 0));
+	atomic<bool> stop{ false };
+	atomic<int> torn{ 0 };
+	vector<thread> readers;
+	for (int t = 0; t < 4; t++)
+		readers.emplace_back([&] {
+			while (!stop) {
+				auto p = shared.load();
+				if (p->first != p->second) torn++;
+			}
+		});
+	for (int i = 1; i <= 2000; i++)
+		shared.store(make_shared<const pair<int, int>>(i, i));
+	stop = true;
+	for (auto& t : readers)
+		t.join();
+	CHECK(torn == 0);
+	CHECK(shared.load()->first == 2000);
+}
+
+
+
+static vector<char> read_file(const string& path)
+{
+	ifstream in(path, ios::binary);
+	return vector<char>(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void write_file(const string& path, const vector<char>& bytes)
+{
+	ofstream out(path, ios::binary | ios::trunc);
+	out.write(bytes.data(), (streamsize)bytes.size());
+}
+
+static void test_mapped_result()
+{
+	cout << "** MAPPED RESULTS" << endl;
+
+	const string path = "unit_test_mapped.bin";
+	const string corrupt_path = "unit_test_corrupt.bin";
+
+	vector<vector<string>> data;
+	for (int i = 0; i < 500; i++)
+		data.push_back({ to_string(i), i % 5 == 0 ? "" : "name" + to_string(i) });
+	fixed_result res(data, 2);
+	cached_result cached(res);
+	CHECK(cached.count() == 500 && cached.fields() == 2);
+
+	save_result(path, cached, "token");
+	auto mapped = mapped_result::open(path);
+	CHECK(mapped != nullptr);
+	if (mapped != nullptr) {
+		CHECK(mapped->freshness() == "token");
+		CHECK(mapped->count() == 500 && mapped->fields() == 2);
+		CHECK(mapped->data_size() == cached.data_size());
+
+		int id = -1;
+		daotk::mysql::optional<string> name;
+		CHECK(mapped->fetch(123, id, name) && id == 123 && name && *name == "name123");
+		CHECK(mapped->fetch(125, id, name) && id == 125 && !name);
+		CHECK(!mapped->fetch(500, id, name));
+
+		// mapped rows can feed a snapshot
+		table_snapshot<int, string> names("select id, name from person");
+		names.hash_index<1>();
+		auto v = names.load_rows(*mapped);
+		CHECK(v->find<1>("name499") == 499);
+	}
+
+	vector<char> bytes = read_file(path);
+	size_t offsets_start = sizeof(mapped_detail::file_header) + mapped_detail::padded(5);
+
+	// an offset beyond the data
+	vector<char> corrupt = bytes;
+	uint64_t beyond = 1ull << 40;
+	memcpy(&corrupt[offsets_start + 10 * sizeof(uint64_t)], &beyond, sizeof(beyond));
+	write_file(corrupt_path, corrupt);
+	CHECK(mapped_result::open(corrupt_path) == nullptr);
+
+	// offsets going backwards, the last one still right
+	corrupt = bytes;
+	uint64_t back = 0;
+	memcpy(&corrupt[offsets_start + 10 * sizeof(uint64_t)], &back, sizeof(back));
+	write_file(corrupt_path, corrupt);
+	CHECK(mapped_result::open(corrupt_path) == nullptr);
+
+	// truncated file, and a file of another format version
+	corrupt.assign(bytes.begin(), bytes.end() - 1);
+	write_file(corrupt_path, corrupt);
+	CHECK(mapped_result::open(corrupt_path) == nullptr);
+
+	corrupt = bytes;
+	uint32_t old_version = 1;
+	memcpy(&corrupt[offsetof(mapped_detail::file_header, format_version)], &old_version, sizeof(old_version));
+	write_file(corrupt_path, corrupt);
+	CHECK(mapped_result::open(corrupt_path) == nullptr);
+
+	CHECK(mapped_result::open("unit_test_missing.bin") == nullptr);
+
+	mapped = nullptr;
+	remove(path.c_str());
+	remove(corrupt_path.c_str());
+}
+
+static void test_spill_file()
+{
+	cout << "** SPILL FILE" << endl;
+
+	// fields of every length modulo 4, empty ones, one with a '\0' inside and one larger than a page
+	vector<vector<string>> data;
+	for (int i = 0; i < 1000; i++)
+		data.push_back({ to_string(i), string((size_t)(i % 9), 'x'), i % 3 == 0 ? "" : "row " + to_string(i) });
+	data.push_back({ string("a\0b", 3), string(10000, 'y'), "last" });
+
+	spill_file file(3);
+	for (auto& row : data) {
+		const char* fields[3];
+		unsigned long lengths[3];
+		for (int i = 0; i < 3; i++) {
+			fields[i] = row[i].data();
+			lengths[i] = (unsigned long)row[i].size();
+		}
+		file.append(fields, lengths);
+	}
+	file.seal();
+	CHECK(file.count() == data.size());
+	CHECK(file.file_size() % 4 == 0);
+
+	bool same = true;
+	for (size_t r = 0; r < data.size(); r++) {
+		for (unsigned int i = 0; i < 3; i++) {
+			size_t len = 0;
+			const char* f = file.field(r, i, len);
+			if (string(f, len) != data[r][i] || f[len] != '\0') same = false;
+		}
+	}
+	CHECK(same);
+
+	// no rows: nothing to map
+	spill_file none(2);
+	none.seal();
+	CHECK(none.count() == 0 && none.file_size() == 0);
+}
+
+
+
+struct person_row {
+	int id = 0;
+	string name;
+	daotk::mysql::optional<double> weight;
+	int avatar = -1;
+
+	MYSQLPP_FIELDS(person_row, id, name, weight, avatar)
+};
+
+// read from a column of another name
+struct renamed_row {
+	string full_name;
+
+	static auto mysqlpp_fields() {
+		return make_tuple(describe_field("name", &renamed_row::full_name));
+	}
+};
+
+static void test_struct_mapping()
+{
+	cout << "** STRUCT MAPPING" << endl;
+
+	CHECK((has_fields<person_row>::value && !has_fields<pair<int, int>>::value));
+	CHECK(field_count<person_row>() == 4);
+
+	// columns are matched by name, case-insensitively; `avatar' has no column
+	const char* names[] = { "WEIGHT", "Id", "name", "extra" };
+	vector<int> columns;
+	match_columns<person_row>(4, [&](unsigned int c) { return names[c]; }, columns);
+	CHECK(columns == vector<int>({ 1, 2, 0, -1 }));
+
+	// one row, as `field_of' gives it: nullptr for NULL
+	auto decode = [&](person_row& p, const vector<const char*>& row) {
+		decode_struct(p, columns, [&](unsigned int c, size_t& len) {
+			len = row[c] != nullptr ? strlen(row[c]) : 0;
+			return row[c];
+		});
+	};
+
+	person_row p;
+	decode(p, { "62.54", "1", "Nguyen Van X", "ignored" });
+	CHECK(p.id == 1 && p.name == "Nguyen Van X" && p.weight && *p.weight == 62.54);
+	CHECK(p.avatar == -1);
+
+	// NULL and unparsable fields are reset, so nothing is left over from the previous row
+	decode(p, { nullptr, "abc", "Bui Xuan Z", "ignored" });
+	CHECK(p.id == 0 && p.name == "Bui Xuan Z" && !p.weight);
+
+	vector<int> renamed_columns;
+	match_columns<renamed_row>(4, [&](unsigned int c) { return names[c]; }, renamed_columns);
+	CHECK(renamed_columns == vector<int>({ 2 }));
+
+	match_columns<renamed_row>(1, [](unsigned int) { return "full_name"; }, renamed_columns);
+	CHECK(renamed_columns == vector<int>({ -1 }));
+}
+
+
+
+int main()
+{
+	test_queues();
+	test_writer();
+	test_group_commit();
+	test_strand();
+	test_statistics();
+	test_metrics();
+	test_binlog_events();
+	test_snapshot();
+	test_mapped_result();
+	test_spill_file();
+	test_struct_mapping();
+
+	if (failures > 0) {
+		cout << failures << " check(s) failed" << endl;
+		return 1;
+	}
+
+	cout << "All checks passed" << endl;
+	return 0;
+}